@@ -0,0 +1,305 @@
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <print>
+#include <thread>
+
+#include "async_regular_path_query.hpp"
+#include "timer.hpp"
+
+#include "BS_thread_pool.hpp"
+
+namespace {
+
+// product graph node is encoded as state * graph_nodes_number + vertex,
+// same order as elements of reacheble matrix
+using ProductNode = uint64_t;
+
+struct alignas(64) WorkDeque {
+  std::mutex mutex;
+  std::deque<ProductNode> items;
+
+  // owner works with back of deque, thieves take from front
+  bool pop(ProductNode &node) {
+    std::lock_guard lock(mutex);
+    if (items.empty()) {
+      return false;
+    }
+    node = items.back();
+    items.pop_back();
+    return true;
+  }
+
+  bool steal(ProductNode &node) {
+    std::unique_lock lock(mutex, std::try_to_lock);
+    if (!lock.owns_lock() || items.empty()) {
+      return false;
+    }
+    node = items.front();
+    items.pop_front();
+    return true;
+  }
+
+  void push(const std::vector<ProductNode> &nodes) {
+    std::lock_guard lock(mutex);
+    items.insert(items.end(), nodes.begin(), nodes.end());
+  }
+};
+
+class VisitedBitset {
+private:
+  std::vector<std::atomic<uint64_t>> _words;
+
+public:
+  explicit VisitedBitset(uint64_t size) : _words((size + 63) / 64) {}
+
+  // returns true if node was not visited before
+  bool visit(ProductNode node) {
+    auto &word = _words[node / 64];
+    uint64_t mask = uint64_t(1) << (node % 64);
+    if (word.load(std::memory_order_relaxed) & mask) {
+      return false;
+    }
+    return !(word.fetch_or(mask, std::memory_order_relaxed) & mask);
+  }
+
+  template <typename F>
+  void for_each(F &&f) const {
+    for (uint64_t i = 0; i < _words.size(); i++) {
+      uint64_t word = _words[i].load(std::memory_order_relaxed);
+      while (word != 0) {
+        f(i * 64 + std::countr_zero(word));
+        word &= word - 1;
+      }
+    }
+  }
+};
+
+}  // namespace
+
+cuBool_Matrix async_regular_path_query_with_adjacency(
+  const std::vector<const CsrAdjacency *> &graph, const std::vector<cuBool_Index> &source_vertices,
+  const std::vector<const CsrAdjacency *> &automat, const std::vector<cuBool_Index> &start_states,
+  cuBool_Index graph_nodes_number, cuBool_Index automat_nodes_number,
+  const QueryBudget &budget, QueryStatus &query_status,
+  std::optional<std::reference_wrapper<std::ostream>> out) {
+  cuBool_Status status;
+  query_status = QueryStatus::Ok;
+
+  const auto start_time = std::chrono::steady_clock::now();
+
+  Timer rpq_timer {};
+  rpq_timer.mark();
+
+  // labels which present both in graph and automat
+  std::vector<std::pair<const CsrAdjacency *, const CsrAdjacency *>> labels;
+  const auto label_number = std::min(graph.size(), automat.size());
+  for (std::size_t i = 0; i < label_number; i++) {
+    if (graph[i] == nullptr || automat[i] == nullptr || graph[i]->empty() || automat[i]->empty()) {
+      continue;
+    }
+    assert(graph[i]->_nrows == graph_nodes_number);
+    assert(automat[i]->_nrows == automat_nodes_number);
+    labels.emplace_back(graph[i], automat[i]);
+  }
+
+  const uint64_t visited_bytes = (uint64_t(automat_nodes_number) * graph_nodes_number + 63) / 8;
+  query_status = budget.check(0, 0, visited_bytes, 0);
+  if (query_status != QueryStatus::Ok) {
+    return nullptr;
+  }
+
+  VisitedBitset visited(uint64_t(automat_nodes_number) * graph_nodes_number);
+
+  BS::thread_pool pool;
+  const auto workers_number = pool.get_thread_count();
+  std::vector<WorkDeque> deques(workers_number);
+
+  // number of nodes which are pushed to deques but not processed yet
+  std::atomic<uint64_t> pending = 0;
+  std::atomic<uint64_t> steals = 0;
+
+  // first exceeded limit, all workers stop when it is set
+  std::atomic<QueryStatus> stop_status = QueryStatus::Ok;
+
+  // init start values of algorithm, distribute them round robin between workers
+  std::size_t next_worker = 0;
+  for (const auto state : start_states) {
+    for (const auto vert : source_vertices) {
+      assert(state < automat_nodes_number);
+      assert(vert < graph_nodes_number);
+      ProductNode node = ProductNode(state) * graph_nodes_number + vert;
+      if (visited.visit(node)) {
+        deques[next_worker].items.push_back(node);
+        next_worker = (next_worker + 1) % workers_number;
+        pending++;
+      }
+    }
+  }
+
+  auto load_time = rpq_timer.measure();
+
+  auto worker = [&](std::size_t worker_index) {
+    auto &own = deques[worker_index];
+    std::vector<ProductNode> discovered;
+
+    auto take = [&](ProductNode &node) {
+      if (own.pop(node)) {
+        return true;
+      }
+      for (std::size_t i = 1; i < workers_number; i++) {
+        if (deques[(worker_index + i) % workers_number].steal(node)) {
+          steals.fetch_add(1, std::memory_order_relaxed);
+          return true;
+        }
+      }
+      return false;
+    };
+
+    // budget is checked every budget_check_period processed nodes
+    constexpr uint64_t budget_check_period = 1024;
+    uint64_t processed = 0;
+
+    ProductNode node;
+    while (stop_status.load(std::memory_order_relaxed) == QueryStatus::Ok) {
+      if (++processed % budget_check_period == 0) {
+        auto frontier = pending.load(std::memory_order_relaxed);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+        auto check_status = budget.check(0, frontier,
+                                         visited_bytes + frontier * sizeof(ProductNode),
+                                         elapsed.count());
+        if (check_status != QueryStatus::Ok) {
+          auto expected = QueryStatus::Ok;
+          stop_status.compare_exchange_strong(expected, check_status);
+          break;
+        }
+      }
+
+      if (!take(node)) {
+        // no barrier here: worker only exits when whole product graph is explored
+        if (pending.load(std::memory_order_acquire) == 0) {
+          break;
+        }
+        std::this_thread::yield();
+        continue;
+      }
+
+      cuBool_Index state = node / graph_nodes_number;
+      cuBool_Index vertex = node % graph_nodes_number;
+
+      discovered.clear();
+      for (auto [graph_adjacency, automat_adjacency] : labels) {
+        auto next_vertices = graph_adjacency->neighbours(vertex);
+        if (next_vertices.empty()) {
+          continue;
+        }
+        for (auto next_state : automat_adjacency->neighbours(state)) {
+          for (auto next_vertex : next_vertices) {
+            ProductNode next = ProductNode(next_state) * graph_nodes_number + next_vertex;
+            if (visited.visit(next)) {
+              discovered.push_back(next);
+            }
+          }
+        }
+      }
+
+      // children must be counted before parent is marked as processed
+      if (!discovered.empty()) {
+        pending.fetch_add(discovered.size(), std::memory_order_relaxed);
+        own.push(discovered);
+      }
+      pending.fetch_sub(1, std::memory_order_release);
+    }
+  };
+
+  for (std::size_t i = 0; i < workers_number; i++) {
+    pool.detach_task([&worker, i]() { worker(i); });
+  }
+  pool.wait();
+
+  query_status = stop_status.load();
+  if (query_status != QueryStatus::Ok) {
+    return nullptr;
+  }
+
+  // this will be answer
+  std::vector<cuBool_Index> rows, cols;
+  visited.for_each([&](ProductNode node) {
+    rows.push_back(node / graph_nodes_number);
+    cols.push_back(node % graph_nodes_number);
+  });
+
+  cuBool_Matrix reacheble {};
+  status = cuBool_Matrix_New(&reacheble, automat_nodes_number, graph_nodes_number);
+  assert(status == CUBOOL_STATUS_SUCCESS);
+  status = cuBool_Matrix_Build(reacheble, rows.data(), cols.data(), rows.size(),
+                               CUBOOL_HINT_VALUES_SORTED);
+  assert(status == CUBOOL_STATUS_SUCCESS);
+
+  if (out.has_value()) {
+    auto &out_value = out.value().get();
+    std::println(out_value, "load time = {}, execute_time = {}, visited = {}, steals = {}",
+                 load_time, rpq_timer.measure(), rows.size(), steals.load());
+  }
+
+  return reacheble;
+}
+
+cuBool_Matrix async_regular_path_query(
+  // vector of sparse graph matrices for each label
+  const std::vector<cuBool_Matrix> &graph, const std::vector<cuBool_Index> &source_vertices,
+  // vector of sparse automat matrices for each label
+  const std::vector<cuBool_Matrix> &automat, const std::vector<cuBool_Index> &start_states,
+  // work with inverted labels
+  const std::vector<bool> &inversed_labels_input, bool all_labels_are_inversed,
+  // limits of query
+  const QueryBudget &budget, QueryStatus &query_status,
+  // for debug
+  std::optional<std::reference_wrapper<std::ostream>> out) {
+  const auto label_number = std::min(graph.size(), automat.size());
+
+  auto inversed_labels = inversed_labels_input;
+  inversed_labels.resize(label_number);
+
+  cuBool_Index graph_nodes_number = 0;
+  cuBool_Index automat_nodes_number = 0;
+
+  // get number of graph nodes
+  for (auto label_matrix : graph) {
+    if (label_matrix != nullptr) {
+      cuBool_Matrix_Nrows(label_matrix, &graph_nodes_number);
+      break;
+    }
+  }
+
+  // get number of automat nodes
+  for (auto label_matrix : automat) {
+    if (label_matrix != nullptr) {
+      cuBool_Matrix_Nrows(label_matrix, &automat_nodes_number);
+      break;
+    }
+  }
+
+  // matrix engine moves frontier by automat^T and graph (graph^T for inversed labels),
+  // so adjacency is taken as is for forward direction and transposed for inversed one
+  std::vector<CsrAdjacency> graph_adjacency(label_number), automat_adjacency(label_number);
+  std::vector<const CsrAdjacency *> graph_pointers(label_number), automat_pointers(label_number);
+  for (std::size_t i = 0; i < label_number; i++) {
+    if (graph[i] == nullptr || automat[i] == nullptr) {
+      continue;
+    }
+    graph_adjacency[i] =
+      CsrAdjacency::from_matrix(graph[i], inversed_labels[i] ^ all_labels_are_inversed);
+    automat_adjacency[i] = CsrAdjacency::from_matrix(automat[i], all_labels_are_inversed);
+    graph_pointers[i] = &graph_adjacency[i];
+    automat_pointers[i] = &automat_adjacency[i];
+  }
+
+  return async_regular_path_query_with_adjacency(graph_pointers, source_vertices,
+                                                 automat_pointers, start_states,
+                                                 graph_nodes_number, automat_nodes_number,
+                                                 budget, query_status, out);
+}
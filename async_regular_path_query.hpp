@@ -0,0 +1,41 @@
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <ostream>
+#include <vector>
+
+#include <cubool/cubool.h>
+
+#include "csr_adjacency.hpp"
+#include "query_budget.hpp"
+
+// Asynchronous RPQ engine: explores product graph (automat state x graph vertex)
+// with per-thread work-stealing deques and without per-level barriers.
+// Result has the same layout as matrix engine: automat_nodes x graph_nodes reacheble matrix.
+// Workers check budget every few nodes, pending nodes count as frontier and there are
+// no iterations to limit. If budget is exceeded, query_status is set and nullptr is returned.
+
+// graph[i] and automat[i] must be already oriented in traverse direction
+// (i.e. transposed for inversed labels), nullptr or empty adjacency means label is absent
+cuBool_Matrix async_regular_path_query_with_adjacency(
+  const std::vector<const CsrAdjacency *> &graph, const std::vector<cuBool_Index> &source_vertices,
+  const std::vector<const CsrAdjacency *> &automat, const std::vector<cuBool_Index> &start_states,
+  cuBool_Index graph_nodes_number, cuBool_Index automat_nodes_number,
+  // limits of query
+  const QueryBudget &budget, QueryStatus &query_status,
+  // for debug
+  std::optional<std::reference_wrapper<std::ostream>> out = std::nullopt);
+
+// same interface as par_regular_path_query, adjacency is extracted from matrices on every call
+cuBool_Matrix async_regular_path_query(
+  // vector of sparse graph matrices for each label
+  const std::vector<cuBool_Matrix> &graph, const std::vector<cuBool_Index> &source_vertices,
+  // vector of sparse automat matrices for each label
+  const std::vector<cuBool_Matrix> &automat, const std::vector<cuBool_Index> &start_states,
+  // work with inverted labels
+  const std::vector<bool> &inversed_labels_input, bool all_labels_are_inversed,
+  // limits of query
+  const QueryBudget &budget, QueryStatus &query_status,
+  // for debug
+  std::optional<std::reference_wrapper<std::ostream>> out = std::nullopt);
@@ -5,477 +5,340 @@
 #include <format>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
 #include <print>
 #include <ranges>
-#include <set>
-
-#include <fast_matrix_market/fast_matrix_market.hpp>
-
-#include "regular_path_query.hpp"
-#include "timer.hpp"
-
-#define QUERIES_LOGS "queries_logs"
-
-struct MatrixData {
-  bool _loaded = false;
-  int64_t _nrows = 0, _ncols = 0;
-  std::vector<cuBool_Index> _rows, _cols;
-  cuBool_Index _nvals = 0;
-
-  cuBool_Matrix _matrix = nullptr, _transposed = nullptr;
-
-  double sizeMb() const {
-    return (sizeof(cuBool_Index) * _nvals * 2) / 1'000'000.0;
-  }
-
-  bool load_to_cpu(std::string_view filename);
-  bool copy_to_gpu(cuBool_Matrix *matrix) const;
-
-  bool load_to_gpu() {
-    return copy_to_gpu(&_matrix);
-  }
-
-  ~MatrixData() {
-    if (_matrix != nullptr) {
-      cuBool_Matrix_Free(_matrix);
+#include <thread>
+
+#include "query.hpp"
+#include "closure_index.hpp"
+#include "query_service.hpp"
+
+// reads budget options from argv[first]...: --max-time <seconds>, --max-iterations <number>,
+// --max-frontier <nnz>, --max-memory <Mb>
+std::optional<QueryBudget> parse_budget(int argc, char **argv, int first) {
+  QueryBudget budget;
+  for (int i = first; i < argc; i += 2) {
+    std::string_view option = argv[i];
+    if (i + 1 >= argc) {
+      std::println("no value for {}", option);
+      return std::nullopt;
+    }
+    std::string_view value = argv[i + 1];
+    if (option == "--max-time") {
+      budget._max_time = std::stod(argv[i + 1]);
+    } else if (option == "--max-iterations") {
+      budget._max_iterations = std::stoull(argv[i + 1]);
+    } else if (option == "--max-frontier") {
+      budget._max_frontier_nnz = std::stoull(argv[i + 1]);
+    } else if (option == "--max-memory") {
+      budget._max_scratch_bytes = std::stoull(argv[i + 1]) * 1'000'000;
+    } else {
+      std::println("unknown option: {} {}", option, value);
+      return std::nullopt;
     }
   }
-};
-using Wikidata = std::vector<MatrixData>;
-
-bool MatrixData::load_to_cpu(std::string_view filename) {
-  if (_loaded) {
-    return true;
-  }
-
-  std::ifstream file(filename.data());
-  if (not file) {
-    return false;
-  }
-
-  std::vector<bool> vals;
-  fast_matrix_market::read_matrix_market_triplet(file, _nrows, _ncols, _rows, _cols, vals);
-  _nvals = vals.size();
-  _loaded = true;
-
-  return true;
-}
-
-bool MatrixData::copy_to_gpu(cuBool_Matrix *matrix) const {
-  cuBool_Status status = CUBOOL_STATUS_SUCCESS;
-
-  status = cuBool_Matrix_New(matrix, _nrows, _ncols);
-  if (status != CUBOOL_STATUS_SUCCESS) {
-    return false;
-  }
-
-  status =
-    cuBool_Matrix_Build(*matrix, _rows.data(), _cols.data(), _nvals, CUBOOL_HINT_NO);
-  if (status != CUBOOL_STATUS_SUCCESS) {
-    return false;
-  }
-
-  return true;
+  return budget;
 }
 
-static Wikidata load_matrices(bool load_at_gpu = false, bool pretransposed = false) {
-  Wikidata matrices(BENCH_LABEL_COUNT + 1);
-  Timer load_matrices_timer {};
+bool benchmark(RpqEngine engine, const QueryBudget &budget, bool use_planner = false,
+               bool use_closures = false) {
+  cuBool_Initialize(CUBOOL_HINT_NO);
 
-  load_matrices_timer.mark();
-  std::cout << "loading at RAM\n";
-  for (uint32_t query_number = 1; query_number <= BENCH_QUERY_COUNT; query_number++) {
-    std::cout << "\rloaded query # " << query_number;
-    std::flush(std::cout);
+  bool preloading = true;
+  bool pretransposed_gpu = false;
+  bool pretransposed = engine == RpqEngine::Matrix;
+  ClosureIndex closure_index;
+  auto matrices = load_matrices(preloading, pretransposed_gpu, engine == RpqEngine::Async,
+                                use_planner, use_closures ? &closure_index : nullptr);
+  uint32_t runs_number = 10;
 
-    std::string filename = std::format("{}{}{}/meta.txt", BENCH_DATASET_DIR, "/Queries/", query_number);
-    std::ifstream query_file(filename);
-    if (not query_file) {
-      continue;
-    }
+  std::filesystem::create_directory(QUERIES_LOGS);
+  auto total_time_file_name = "total_time_file.txt";
+  std::filesystem::remove(total_time_file_name);
 
-    // read sourse and dest
-    int tmp1, tmp2;
-    query_file >> tmp1 >> tmp2;
-    if (tmp1 == 0 && tmp2 == 0) {
-      continue;
-    }
+  for (uint32_t run = 1; run <= runs_number; run++) {
+    auto result_file_name = runs_number == 1 ? std::string("result.txt")
+                                             : std::format("result{}.txt", run);
+    std::fstream results_file(result_file_name, std::ofstream::out);
+    double total_load_time = 0;
+    double total_execute_time = 0;
 
-    // read start vertices and start states
-    for (int _ = 0; _ < 2; _++) {
-      query_file >> tmp1;
-      for (int i = 0; i < tmp1; i++) {
-        query_file >> tmp2;
+    // planner may run pair query backward, then result counts sources instead of
+    // destinations, so whether dest is reached from source is reported too
+    std::println("run {}", run);
+    std::println("query_number execute_time load_time result{}", use_planner ? " reached" : "");
+    for (uint32_t query_number = 1; query_number <= BENCH_QUERY_COUNT; query_number++) {
+    // for (uint32_t query_number = 1003; query_number <= 1003; query_number++) {
+      Query query;
+      query._engine = engine;
+      query._use_planner = use_planner;
+      query._closure_index = use_closures ? &closure_index : nullptr;
+      query._budget = budget;
+      auto [load_successfully, load_time] =
+        query.load(query_number, matrices, preloading, pretransposed, pretransposed_gpu);
+      if (!load_successfully) {
+        std::println("{} skipped", query_number);
+        continue;
       }
-    }
-
-    uint32_t labels_number = 0;
-    query_file >> labels_number;
-    for (int i = 0; i < labels_number; i++) {
-      int label;
-      query_file >> label;
-      label = std::abs(label);
-
-      std::string filename = std::format("{}{}{}.txt", BENCH_DATASET_DIR, "/Graph/", label);
-      matrices[label].load_to_cpu(filename);
-    }
-  }
-  std::cout << "\r";
-  double elapsed = load_matrices_timer.measure();
-  std::cout << "matrices loaded, time: " << elapsed << "s\n";
-
-  if (load_at_gpu) {
-    load_matrices_timer.mark();
-    std::println("loading at VRAM");
-    uint32_t initial_free_mem = get_used_memory();
-    for (int i = 0; i < matrices.size(); i++) {
-      uint32_t free_mem = get_used_memory();
-
-      auto &data = matrices[i];
-      if (!data._loaded) {
+      auto [result, execute_time] = query.execute();
+      query.clear();
+      // queries over budget are stopped and reported
+      if (query._status != QueryStatus::Ok) {
+        std::println("{} stopped after {}: {}", query_number, execute_time,
+                     to_string(query._status));
         continue;
       }
 
-      data.load_to_gpu();
-
-      if (pretransposed && data._matrix != nullptr) {
-        cuBool_Index nrows, ncols;
-        cuBool_Matrix_Nrows(data._matrix, &nrows);
-        cuBool_Matrix_Ncols(data._matrix, &ncols);
-
-        cuBool_Matrix_New(&data._transposed, ncols, nrows);
-        cuBool_Matrix_Transpose(data._transposed, data._matrix, CUBOOL_HINT_NO);
+      std::string reached;
+      if (use_planner) {
+        reached = query._target_reached.has_value()
+                  ? std::format(" {}", int(query._target_reached.value())) : " -";
       }
+      std::println("{} {} {} {}{}", query_number, execute_time, load_time, result, reached);
+      std::println(results_file, "{} {} {} {}{}", query_number, execute_time, load_time, result,
+                   reached);
 
-      uint32_t new_free_mem = get_used_memory();
-      std::print("\r");
-      std::print("matrix #{}: now used: {}, diff used: {}, actual size: {}", i, new_free_mem,
-                 new_free_mem - free_mem, data.sizeMb());
-      std::flush(std::cout);
-    }
-    elapsed = load_matrices_timer.measure();
-    std::print("\r");
-    std::println("matrices loaded at GPU, time: {}s, used memory: {}",
-                  elapsed, get_used_memory() - initial_free_mem);
-  }
-
-  return matrices;
-}
-
-struct Query {
-  std::vector<cuBool_Matrix> _graph;
-  std::vector<cuBool_Matrix> _automat;
-
-  std::vector<cuBool_Matrix> _graph_transposed;
-  std::vector<cuBool_Matrix> _automat_transposed;
-  bool _transposed = false;
-
-  std::vector<cuBool_Index> _sourece_vertices;
-  std::vector<cuBool_Index> _start_states;
-
-  std::vector<cuBool_Index> _final_states;
-
-  std::vector<uint32_t> _labels;
-  std::vector<bool> _inverse_lables;
-  bool _labels_inversed = false;
-
-  bool _matrices_was_loaded = true;
-
-  uint32_t _query_number = 0;
-  Timer _query_timer;
-
-  std::pair<bool, double> load(uint32_t query_number, const Wikidata &matrices,
-                               bool preloaded = false, bool transpose = true, bool pretransposed = false);
-  std::pair<uint32_t, double> execute();
-  void clear();
-
-  // load + execute + clear
-  std::pair<uint32_t, double> make(uint32_t query_number, const Wikidata &matrices,
-                                   bool preloaded = false, bool transpose = true) {
-    if (!load(query_number, matrices, preloaded, transpose).first) {
-      clear();
-      return {0, 0};
+      total_load_time += load_time;
+      total_execute_time += execute_time;
     }
-    auto answer = execute();
-    clear();
-    return answer;
-  }
 
+    std::println("\n\n");
+    std::println("total load time: {}, total execute time: {}\n",
+                 total_load_time, total_execute_time);
 
-  ~Query() {
-    clear();
+    std::ofstream total_time_file(total_time_file_name, std::ios_base::ate);
+    std::println(total_time_file, "total load time: {}, total execute time: {}\n",
+                                  total_load_time, total_execute_time);
+    total_time_file.close();
   }
-};
-
-std::pair<bool, double> Query::load(uint32_t query_number, const Wikidata &matrices,
-                                    bool preloaded, bool transpose, bool pretransposed) {
-  _query_timer.mark();
-  _query_number = query_number;
 
-  std::string filename = std::format("{}{}{}/meta.txt", BENCH_DATASET_DIR, "/Queries/", query_number);
-  std::ifstream query_file(filename);
-  if (!query_file) {
-    return {false, 0};
-  }
+  cuBool_Finalize();
 
-  cuBool_Index source = 0, dest = 0;
-  query_file >> source >> dest;
-  if (source == 0 && dest == 0) {
-    source = 1;
-    // return {false, 0};
-  }
-  source--;
-  dest--;
-
-  uint32_t src_verts_number = 0;
-  query_file >> src_verts_number;
-  std::vector<cuBool_Index> src_verts(src_verts_number);
-  for (auto &vert : src_verts) {
-    query_file >> vert;
-    vert--;
-  }
+  return true;
+}
 
-  uint32_t inv_src_vert_number = 0;
-  query_file >> inv_src_vert_number;
-  std::vector<cuBool_Index> inv_src_verts(src_verts_number);
-  for (auto &vert : inv_src_verts) {
-    query_file >> vert;
-    vert--;
-  }
+// one query with 1, 2, 4, ... hardware threads workers of matrix engine,
+// best of runs_number executions for every threads number
+bool benchmark_scaling(uint32_t query_number, uint32_t runs_number) {
+  cuBool_Initialize(CUBOOL_HINT_NO);
 
-  uint32_t labels_number = 0;
-  query_file >> labels_number;
-  _labels.resize(labels_number);
-  _inverse_lables.resize(labels_number);
-  for (int i = 0; i < labels_number; i++) {
-    int label;
-    query_file >> label;
-    _labels[i] = std::abs(label);
-    _inverse_lables[i] = label < 0;
-  }
+  bool preloading = true;
+  auto matrices = load_matrices(preloading);
 
-  _graph.assign(labels_number, nullptr);
-  _automat.assign(labels_number, nullptr);
+  std::filesystem::create_directory(QUERIES_LOGS);
 
-  _matrices_was_loaded = !preloaded;
-  _transposed = transpose;
+  const std::size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  double single_thread_time = 0;
 
-  for (int i = 0; i < labels_number; i++) {
-    uint32_t label = _labels[i];
-    if (!preloaded) {
-      if (not matrices[label].copy_to_gpu(&_graph[i])) {
-        return {false, 0};
+  std::println("threads execute_time speedup result");
+  for (std::size_t threads = 1;; threads = std::min(threads * 2, max_threads)) {
+    double best_time = std::numeric_limits<double>::max();
+    uint32_t result = 0;
+    for (uint32_t run = 0; run < runs_number; run++) {
+      Query query;
+      query._threads_number = threads;
+      if (!query.load(query_number, matrices, preloading).first) {
+        std::println("{} skipped", query_number);
+        cuBool_Finalize();
+        return false;
       }
-    } else {
-      _graph[i] = matrices[label]._matrix;
+      auto [answer, execute_time] = query.execute();
+      query.clear();
+      best_time = std::min(best_time, execute_time);
+      result = answer;
+    }
+    if (threads == 1) {
+      single_thread_time = best_time;
     }
+    std::println("{} {} {} {}", threads, best_time, single_thread_time / best_time, result);
 
-    filename = std::format("{}{}{}/{}.txt", BENCH_DATASET_DIR, "/Queries/", query_number,
-                           _inverse_lables[i] ? -(int)label : (int)label);
-    MatrixData data;
-    if (not data.load_to_cpu(filename) || not data.copy_to_gpu(&_automat[i])) {
-      return {false, 0};
+    if (threads == max_threads) {
+      break;
     }
   }
 
-  if (transpose) {
-    _graph_transposed.reserve(_graph.size());
-    if (!pretransposed) {
-      for (auto label_matrix : _graph) {
-        _graph_transposed.emplace_back();
+  cuBool_Finalize();
 
-        if (label_matrix == nullptr) {
-          continue;
-        }
+  return true;
+}
 
-        cuBool_Index nrows, ncols;
-        cuBool_Matrix_Nrows(label_matrix, &nrows);
-        cuBool_Matrix_Ncols(label_matrix, &ncols);
+// queries from a window of consecutive numbers with the same source vertices
+// and direction are evaluated together by execute_batch;
+// if check_answers is set, every query is also executed alone and answers are compared
+bool benchmark_batched(uint32_t window_size, const QueryBudget &budget,
+                       bool check_answers = false) {
+  cuBool_Initialize(CUBOOL_HINT_NO);
 
-        cuBool_Matrix_New(&_graph_transposed.back(), ncols, nrows);
-        cuBool_Matrix_Transpose(_graph_transposed.back(), label_matrix, CUBOOL_HINT_NO);
-      }
-    } else {
-      for (int i = 0; i < labels_number; i++) {
-        uint32_t label = _labels[i];
-        _graph_transposed[i] = matrices[label]._transposed;
-      }
-    }
+  bool preloading = true;
+  auto matrices = load_matrices(preloading);
 
-    // transpose automat matrices
-    _automat_transposed.reserve(_automat.size());
-    for (auto label_matrix : _automat) {
-      _automat_transposed.emplace_back();
-      if (label_matrix == nullptr) {
+  std::filesystem::create_directory(QUERIES_LOGS);
+  std::fstream results_file("result_batched.txt", std::ofstream::out);
+  double total_load_time = 0;
+  double total_execute_time = 0;
+  double total_single_time = 0;
+  uint32_t mismatches = 0;
+
+  std::println("query_number execute_time load_time result batch_size");
+  for (uint32_t window = 1; window <= BENCH_QUERY_COUNT; window += window_size) {
+    std::vector<std::unique_ptr<Query>> queries;
+    std::vector<double> load_times;
+    std::map<std::pair<std::vector<cuBool_Index>, bool>, std::vector<Query *>> groups;
+
+    uint32_t window_end = std::min<uint32_t>(window + window_size - 1, BENCH_QUERY_COUNT);
+    for (uint32_t query_number = window; query_number <= window_end; query_number++) {
+      auto query = std::make_unique<Query>();
+      query->_budget = budget;
+      auto [load_successfully, load_time] = query->load(query_number, matrices, preloading);
+      if (!load_successfully) {
+        std::println("{} skipped", query_number);
         continue;
       }
-
-      cuBool_Index nrows, ncols;
-      cuBool_Matrix_Nrows(label_matrix, &nrows);
-      cuBool_Matrix_Ncols(label_matrix, &ncols);
-
-      cuBool_Matrix_New(&_automat_transposed.back(), ncols, nrows);
-      cuBool_Matrix_Transpose(_automat_transposed.back(), label_matrix, CUBOOL_HINT_NO);
+      total_load_time += load_time;
+      load_times.push_back(load_time);
+      groups[{query->_sourece_vertices, query->_labels_inversed}].push_back(query.get());
+      queries.push_back(std::move(query));
     }
-  }
-
-  if (source == std::numeric_limits<cuBool_Index>::max()) {
-    _start_states = std::move(inv_src_verts);
-    _final_states = std::move(src_verts);
-    _sourece_vertices = std::vector {dest};
-    _labels_inversed = true;
-  } else {
-    _start_states = std::move(src_verts);
-    _final_states = std::move(inv_src_verts);
-    _sourece_vertices = std::vector {source};
-    _labels_inversed = false;
-  }
 
-  return {true, _query_timer.measure()};
-}
-
-void Query::clear() {
-  if (_matrices_was_loaded) {
-    for (auto &matrix : _graph) {
-      if (matrix != nullptr) {
-        cuBool_Matrix_Free(matrix);
-        matrix = nullptr;
+    std::map<uint32_t, std::pair<std::pair<uint32_t, double>, std::size_t>> results;
+    for (auto &[_, group] : groups) {
+      auto answers = execute_batch(group);
+      for (std::size_t i = 0; i < group.size(); i++) {
+        results[group[i]->_query_number] = {answers[i], group.size()};
       }
     }
-  }
 
-  for (auto &matrix : _automat) {
-    if (matrix != nullptr) {
-      cuBool_Matrix_Free(matrix);
-      matrix = nullptr;
-    }
-  }
-
-  // std::println("clear 3 transposed");
-  if (_transposed) {
-    for (auto &matrix : _graph_transposed) {
-      if (matrix != nullptr) {
-        cuBool_Matrix_Free(matrix);
-        matrix = nullptr;
+    for (std::size_t i = 0; i < queries.size(); i++) {
+      auto query_number = queries[i]->_query_number;
+      auto [answer, batch_size] = results[query_number];
+      auto [result, execute_time] = answer;
+      if (queries[i]->_status != QueryStatus::Ok) {
+        std::println("{} stopped after {}: {}", query_number, execute_time,
+                     to_string(queries[i]->_status));
+        continue;
       }
-    }
-    for (auto &matrix : _automat_transposed) {
-      if (matrix != nullptr) {
-        cuBool_Matrix_Free(matrix);
-        matrix = nullptr;
+      std::println("{} {} {} {} {}", query_number, execute_time, load_times[i], result, batch_size);
+      std::println(results_file, "{} {} {} {}", query_number, execute_time, load_times[i], result);
+      total_execute_time += execute_time;
+
+      if (check_answers) {
+        auto [single_result, single_time] = queries[i]->execute();
+        total_single_time += single_time;
+        if (queries[i]->_status == QueryStatus::Ok && single_result != result) {
+          std::println("{} results differ: batched {}, single {}", query_number, result,
+                       single_result);
+          mismatches++;
+        }
       }
     }
   }
-}
 
-std::pair<uint32_t, double> Query::execute() {
-  std::string filename = std::format("{}/{}.txt", QUERIES_LOGS, _query_number);
-  std::ofstream log_file(filename);
-
-  cuBool_Matrix recheable = nullptr;
-
-  static Timer make_query_timer {};
-
-  make_query_timer.mark();
-  if (_transposed) {
-    recheable = regular_path_query_with_transposed(_graph, _sourece_vertices,
-                                                   _automat, _start_states,
-                                                   _graph_transposed,
-                                                   _automat_transposed,
-                                                   _inverse_lables, _labels_inversed);
-  } else {
-    recheable = regular_path_query(_graph, _sourece_vertices,
-                                   _automat, _start_states,
-                                   _inverse_lables, _labels_inversed);
+  std::println("\n\n");
+  std::println("total load time: {}, total execute time: {}\n",
+               total_load_time, total_execute_time);
+  if (check_answers) {
+    std::println("total single execute time: {}, mismatches: {}\n", total_single_time,
+                 mismatches);
   }
 
-  cuBool_Index automat_rows, graph_rows;
-  cuBool_Matrix_Nrows(_graph.front(), &graph_rows);
-  cuBool_Matrix_Nrows(_automat.front(), &automat_rows);
-
-  cuBool_Vector P, F;
-  cuBool_Vector_New(&P, graph_rows);
-  cuBool_Vector_New(&F, automat_rows);
-
-  cuBool_Vector_Build(F, _final_states.data(), _final_states.size(), CUBOOL_HINT_NO);
-  cuBool_VxM(P, F, recheable, CUBOOL_HINT_NO);
-  uint32_t answer = 0;
-  cuBool_Vector_Nvals(P, &answer);
-
-  auto time = make_query_timer.measure();
-
-  cuBool_Vector_Free(P);
-  cuBool_Vector_Free(F);
-  cuBool_Matrix_Free(recheable);
+  cuBool_Finalize();
 
-  return {answer, time};
+  return mismatches == 0;
 }
 
-bool benchmark() {
+// variant checked against plain matrix engine by compare mode
+enum class CompareMode {
+  // async engine
+  Async,
+  // matrix engine with direction of pair queries chosen by planner
+  Planned,
+  // matrix engine with automata rewritten to use closure index
+  Indexed,
+};
+
+// run every query by matrix engine and by variant, check answers and write times side by side
+bool compare(CompareMode mode) {
   cuBool_Initialize(CUBOOL_HINT_NO);
 
   bool preloading = true;
-  bool pretransposed_gpu = false;
-  bool pretransposed = true;
-  auto matrices = load_matrices(preloading, pretransposed_gpu);
-  uint32_t runs_number = 10;
+  ClosureIndex closure_index;
+  auto matrices = load_matrices(preloading, false, mode == CompareMode::Async,
+                                mode == CompareMode::Planned,
+                                mode == CompareMode::Indexed ? &closure_index : nullptr);
 
-  std::set<uint32_t> too_big_queris = {115};
-  too_big_queris = {};
+  std::string_view variant_name = mode == CompareMode::Async     ? "async"
+                                  : mode == CompareMode::Planned ? "planned"
+                                                                 : "indexed";
 
   std::filesystem::create_directory(QUERIES_LOGS);
-  auto total_time_file_name = "total_time_file.txt";
-  std::filesystem::remove(total_time_file_name);
-
-  for (uint32_t run = 1; run <= runs_number; run++) {
-    auto result_file_name = runs_number == 1 ? std::string("result.txt")
-                                             : std::format("result{}.txt", run);
-    std::fstream results_file(result_file_name, std::ofstream::out);
-    double total_load_time = 0;
-    double total_execute_time = 0;
+  std::fstream results_file(mode == CompareMode::Async ? "engines.txt"
+                                                       : std::format("{}.txt", variant_name),
+                            std::ofstream::out);
 
-    std::println("run {}", run);
-    std::println("query_number execute_time load_time result");
-    for (uint32_t query_number = 1; query_number <= BENCH_QUERY_COUNT; query_number++) {
-    // for (uint32_t query_number = 1003; query_number <= 1003; query_number++) {
-      if (too_big_queris.contains(query_number)) {
-        continue;
-      }
-
-      Query query;
-      auto [load_successfully, load_time] =
-        query.load(query_number, matrices, preloading, pretransposed, pretransposed_gpu);
-      if (!load_successfully) {
-        std::println("{} skipped", query_number);
-        continue;
-      }
-      auto [result, execute_time] = query.execute();
-      query.clear();
+  double total_matrix_time = 0;
+  double total_variant_time = 0;
+  uint32_t mismatches = 0;
 
-      std::println("{} {} {} {}", query_number, execute_time, load_time, result);
-      std::println(results_file, "{} {} {} {}", query_number, execute_time, load_time, result);
+  std::println("query_number matrix_time {}_time result", variant_name);
+  for (uint32_t query_number = 1; query_number <= BENCH_QUERY_COUNT; query_number++) {
+    Query matrix_query, variant_query;
+    variant_query._engine = mode == CompareMode::Async ? RpqEngine::Async : RpqEngine::Matrix;
+    variant_query._use_planner = mode == CompareMode::Planned;
+    variant_query._closure_index = mode == CompareMode::Indexed ? &closure_index : nullptr;
+    if (!matrix_query.load(query_number, matrices, preloading).first ||
+        !variant_query.load(query_number, matrices, preloading,
+                            variant_query._engine == RpqEngine::Matrix).first) {
+      std::println("{} skipped", query_number);
+      continue;
+    }
 
-      total_load_time += load_time;
-      total_execute_time += execute_time;
+    auto [matrix_result, matrix_time] = matrix_query.execute();
+    auto [variant_result, variant_time] = variant_query.execute();
+
+    // pair query run in other direction counts other vertices, only reachability must match
+    bool same_direction = matrix_query._labels_inversed == variant_query._labels_inversed;
+    bool same = same_direction ? matrix_result == variant_result
+                               : matrix_query._target_reached == variant_query._target_reached;
+    if (!same) {
+      std::println("{} results differ: matrix {}, {} {}", query_number, matrix_result,
+                   variant_name, variant_result);
+      mismatches++;
     }
 
-    std::println("\n\n");
-    std::println("total load time: {}, total execute time: {}\n",
-                 total_load_time, total_execute_time);
+    std::println("{} {} {} {}", query_number, matrix_time, variant_time, matrix_result);
+    std::println(results_file, "{} {} {} {}", query_number, matrix_time, variant_time,
+                 matrix_result);
 
-    std::ofstream total_time_file(total_time_file_name, std::ios_base::ate);
-    std::println(total_time_file, "total load time: {}, total execute time: {}\n",
-                                  total_load_time, total_execute_time);
-    total_time_file.close();
+    total_matrix_time += matrix_time;
+    total_variant_time += variant_time;
   }
 
+  std::println("\n\n");
+  std::println("total matrix time: {}, total {} time: {}, mismatches: {}\n",
+               total_matrix_time, variant_name, total_variant_time, mismatches);
+
   cuBool_Finalize();
 
-  return true;
+  return mismatches == 0;
 }
 
 int main(int argc, char **argv) {
   std::println("Dataset: {}\n", BENCH_DATASET_DIR);
+
+  // usage: rpq_bench [matrix|async|planned|indexed] [budget options]
+  //        rpq_bench compare [async|planned|indexed]
+  //        rpq_bench compare batched [window_size]
+  //        rpq_bench batched [window_size] [budget options]
+  //        rpq_bench scaling <query_number> [runs_number]
+  //        rpq_bench serve <socket> [workers_number [label_cache_mb]] [budget options]
+  // budget options: --max-time <seconds> --max-iterations <number>
+  //                 --max-frontier <nnz> --max-memory <Mb>
+  //        rpq_bench request <socket> <request>
+  std::string_view mode = argc > 1 ? argv[1] : "matrix";
 #if 0
   std::jthread thread([](std::stop_token token) {
     auto max_mem = get_used_memory();
@@ -490,5 +353,80 @@ int main(int argc, char **argv) {
   });
 #endif
 
-  return benchmark() ? 0 : 1;
+  // optional positional argument goes before budget options
+  auto has_positional = [&](int index) {
+    return argc > index && !std::string_view(argv[index]).starts_with("--");
+  };
+
+  if (mode == "serve" && argc > 2) {
+    std::size_t workers_number = has_positional(3) ? std::stoul(argv[3]) : 2;
+    double label_cache_mb = has_positional(3) && has_positional(4) ? std::stod(argv[4]) : 0;
+    int options_begin = 3 + has_positional(3) + (has_positional(3) && has_positional(4));
+    auto budget = parse_budget(argc, argv, options_begin);
+    if (!budget.has_value()) {
+      return 1;
+    }
+    return run_query_service(argv[2], workers_number, label_cache_mb, budget.value()) ? 0 : 1;
+  }
+  if (mode == "request" && argc > 3) {
+    std::string request = argv[3];
+    for (int i = 4; i < argc; i++) {
+      request += std::format(" {}", argv[i]);
+    }
+    return query_service_request(argv[2], request) ? 0 : 1;
+  }
+  if (mode == "compare") {
+    std::string_view variant = argc > 2 ? argv[2] : "async";
+    if (variant == "planned") {
+      return compare(CompareMode::Planned) ? 0 : 1;
+    }
+    if (variant == "indexed") {
+      return compare(CompareMode::Indexed) ? 0 : 1;
+    }
+    if (variant == "batched") {
+      uint32_t window_size = argc > 3 ? std::stoul(argv[3]) : 64;
+      return benchmark_batched(window_size, {}, true) ? 0 : 1;
+    }
+    if (variant != "async") {
+      std::println("unknown compare mode: {}", variant);
+      return 1;
+    }
+    return compare(CompareMode::Async) ? 0 : 1;
+  }
+  if (mode == "scaling" && argc > 2) {
+    uint32_t runs_number = argc > 3 ? std::stoul(argv[3]) : 5;
+    return benchmark_scaling(std::stoul(argv[2]), runs_number) ? 0 : 1;
+  }
+  if (mode == "batched") {
+    uint32_t window_size = has_positional(2) ? std::stoul(argv[2]) : 64;
+    auto budget = parse_budget(argc, argv, has_positional(2) ? 3 : 2);
+    if (!budget.has_value()) {
+      return 1;
+    }
+    return benchmark_batched(window_size, budget.value()) ? 0 : 1;
+  }
+
+  // default mode has no name, so options may start right after program name
+  int options_begin = argc > 1 && std::string_view(argv[1]).starts_with("--") ? 1 : 2;
+  if (options_begin == 1) {
+    mode = "matrix";
+  }
+  auto budget = parse_budget(argc, argv, options_begin);
+  if (!budget.has_value()) {
+    return 1;
+  }
+  if (mode == "indexed") {
+    return benchmark(RpqEngine::Matrix, budget.value(), false, true) ? 0 : 1;
+  }
+  if (mode == "planned") {
+    return benchmark(RpqEngine::Matrix, budget.value(), true) ? 0 : 1;
+  }
+  if (mode == "async") {
+    return benchmark(RpqEngine::Async, budget.value()) ? 0 : 1;
+  }
+  if (mode != "matrix") {
+    std::println("unknown mode: {}", mode);
+    return 1;
+  }
+  return benchmark(RpqEngine::Matrix, budget.value()) ? 0 : 1;
 }
@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <print>
+#include <sstream>
+
+#include "closure_index.hpp"
+
+#include "BS_thread_pool.hpp"
+
+std::vector<std::vector<uint32_t>> read_closure_config(std::string_view filename) {
+  std::vector<std::vector<uint32_t>> label_sets;
+
+  std::ifstream file(filename.data());
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream stream(line);
+    std::vector<uint32_t> labels;
+    uint32_t label;
+    while (stream >> label) {
+      labels.push_back(label);
+    }
+    if (labels.empty()) {
+      continue;
+    }
+    std::ranges::sort(labels);
+    labels.erase(std::unique(labels.begin(), labels.end()), labels.end());
+    label_sets.push_back(std::move(labels));
+  }
+
+  return label_sets;
+}
+
+uint64_t build_closure(const Wikidata &matrices, const std::vector<uint32_t> &labels,
+                       MatrixData &closure) {
+  cuBool_Index nodes = 0;
+  std::vector<cuBool_Index> rows, cols;
+  for (auto label : labels) {
+    const auto &data = matrices[label];
+    nodes = std::max<cuBool_Index>(nodes, std::max(data._nrows, data._ncols));
+    rows.insert(rows.end(), data.rows(), data.rows() + data._nvals);
+    cols.insert(cols.end(), data.cols(), data.cols() + data._nvals);
+  }
+  auto adjacency = CsrAdjacency::from_pairs(nodes, nodes, rows.data(), cols.data(), rows.size());
+
+  // BFS from every vertex with outgoing edges, sources are split into blocks
+  // and every block collects its pairs separately, so result order does not
+  // depend on scheduling; every worker takes blocks one by one and reuses its scratch
+  BS::thread_pool pool;
+  const std::size_t workers_number = pool.get_thread_count();
+  const std::size_t blocks_number = workers_number * 4;
+  const cuBool_Index block_size = (nodes + blocks_number - 1) / blocks_number;
+  std::vector<std::vector<cuBool_Index>> block_rows(blocks_number), block_cols(blocks_number);
+  std::atomic<std::size_t> next_block = 0;
+  std::atomic<uint64_t> scratch_bytes = 0;
+
+  for (std::size_t worker = 0; worker < workers_number; worker++) {
+    pool.detach_task([&]() {
+      // visited[v] == source + 1 if v was reached from source
+      std::vector<cuBool_Index> visited(nodes, 0);
+      std::vector<cuBool_Index> queue;
+
+      for (auto block = next_block++; block < blocks_number; block = next_block++) {
+        cuBool_Index begin = std::min<uint64_t>(uint64_t(block) * block_size, nodes);
+        cuBool_Index end = std::min<uint64_t>(uint64_t(begin) + block_size, nodes);
+        for (cuBool_Index source = begin; source < end; source++) {
+          if (adjacency.neighbours(source).empty()) {
+            continue;
+          }
+
+          // path must be non empty, so source itself is not marked
+          queue.assign(1, source);
+          for (std::size_t head = 0; head < queue.size(); head++) {
+            for (auto next : adjacency.neighbours(queue[head])) {
+              if (visited[next] == source + 1) {
+                continue;
+              }
+              visited[next] = source + 1;
+              queue.push_back(next);
+              block_rows[block].push_back(source);
+              block_cols[block].push_back(next);
+            }
+          }
+        }
+      }
+
+      scratch_bytes += (visited.capacity() + queue.capacity()) * sizeof(cuBool_Index);
+    });
+  }
+  pool.wait();
+
+  closure._nrows = nodes;
+  closure._ncols = nodes;
+  closure._rows.clear();
+  closure._cols.clear();
+  for (std::size_t block = 0; block < blocks_number; block++) {
+    closure._rows.insert(closure._rows.end(), block_rows[block].begin(), block_rows[block].end());
+    closure._cols.insert(closure._cols.end(), block_cols[block].begin(), block_cols[block].end());
+  }
+  closure._nvals = closure._rows.size();
+  closure._loaded = true;
+
+  // union adjacency and per worker BFS scratch, all of them are live at once
+  return scratch_bytes + (adjacency._offsets.capacity() * sizeof(uint64_t) +
+                          adjacency._columns.capacity() * sizeof(cuBool_Index) +
+                          (rows.capacity() + cols.capacity()) * sizeof(cuBool_Index));
+}
+
+bool save_matrix_market(const MatrixData &data, std::string_view filename) {
+  std::ofstream file(filename.data());
+  if (!file) {
+    return false;
+  }
+
+  std::println(file, "%%MatrixMarket matrix coordinate pattern general");
+  std::println(file, "{} {} {}", data._nrows, data._ncols, data._nvals);
+  for (cuBool_Index i = 0; i < data._nvals; i++) {
+    std::println(file, "{} {}", data.rows()[i] + 1, data.cols()[i] + 1);
+  }
+
+  return bool(file);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "query.hpp"
+
+// Index of label-constrained transitive closures L+ for configured label sets L.
+// Closures are kept in the label store (Wikidata) after graph labels, so queries
+// use them as ordinary labels: automat state with self loops over exactly L
+// gets one closure transition instead of fixpoint iterations (see Query::substitute_closures).
+struct ClosureIndex {
+  // sorted label set -> index of its closure in label store
+  std::map<std::vector<uint32_t>, uint32_t> _closures;
+
+  double _build_time = 0;
+  double _size_mb = 0;
+  // peak temporary memory of one closure build, closures are built one by one
+  double _build_scratch_mb = 0;
+
+  std::optional<uint32_t> find(const std::vector<uint32_t> &labels) const {
+    auto it = _closures.find(labels);
+    if (it == _closures.end()) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+};
+
+// every line of config is one label set, e.g. "3" for 3* or "1 2" for (1|2)*
+std::vector<std::vector<uint32_t>> read_closure_config(std::string_view filename);
+
+// closure = L+ over union of labels, labels must be loaded at CPU,
+// returns bytes of temporary memory used during build
+uint64_t build_closure(const Wikidata &matrices, const std::vector<uint32_t> &labels,
+                       MatrixData &closure);
+
+bool save_matrix_market(const MatrixData &data, std::string_view filename);
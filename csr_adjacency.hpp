@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <cubool/cubool.h>
+
+// host-side CSR copy of a boolean label matrix, used by engines that walk
+// the graph vertex by vertex instead of multiplying whole matrices
+struct CsrAdjacency {
+  cuBool_Index _nrows = 0, _ncols = 0;
+  std::vector<uint64_t> _offsets;
+  std::vector<cuBool_Index> _columns;
+
+  bool empty() const {
+    return _offsets.empty();
+  }
+
+  uint64_t nvals() const {
+    return _columns.size();
+  }
+
+  uint64_t bytes() const {
+    return _offsets.size() * sizeof(uint64_t) + _columns.size() * sizeof(cuBool_Index);
+  }
+
+  std::span<const cuBool_Index> neighbours(cuBool_Index row) const {
+    assert(row < _nrows);
+    return {_columns.data() + _offsets[row], _columns.data() + _offsets[row + 1]};
+  }
+
+  // build from (row, col) pairs, if transposed is set pairs are stored as (col, row)
+  static CsrAdjacency from_pairs(cuBool_Index nrows, cuBool_Index ncols,
+                                 const cuBool_Index *rows, const cuBool_Index *cols,
+                                 uint64_t nvals, bool transposed = false) {
+    if (transposed) {
+      std::swap(nrows, ncols);
+      std::swap(rows, cols);
+    }
+
+    CsrAdjacency adjacency;
+    adjacency._nrows = nrows;
+    adjacency._ncols = ncols;
+    adjacency._offsets.assign(nrows + 1, 0);
+    adjacency._columns.resize(nvals);
+
+    // counting sort by row, stable so sorted input gives sorted rows
+    for (uint64_t i = 0; i < nvals; i++) {
+      assert(rows[i] < nrows);
+      adjacency._offsets[rows[i] + 1]++;
+    }
+    for (cuBool_Index row = 0; row < nrows; row++) {
+      adjacency._offsets[row + 1] += adjacency._offsets[row];
+    }
+
+    std::vector<uint64_t> positions(adjacency._offsets.begin(), adjacency._offsets.end() - 1);
+    for (uint64_t i = 0; i < nvals; i++) {
+      adjacency._columns[positions[rows[i]]++] = cols[i];
+    }
+
+    return adjacency;
+  }
+
+  static CsrAdjacency from_matrix(cuBool_Matrix matrix, bool transposed = false) {
+    if (matrix == nullptr) {
+      return {};
+    }
+
+    cuBool_Index nrows = 0, ncols = 0, nvals = 0;
+    cuBool_Matrix_Nrows(matrix, &nrows);
+    cuBool_Matrix_Ncols(matrix, &ncols);
+    cuBool_Matrix_Nvals(matrix, &nvals);
+
+    std::vector<cuBool_Index> rows(nvals), cols(nvals);
+    cuBool_Status status = cuBool_Matrix_ExtractPairs(matrix, rows.data(), cols.data(), &nvals);
+    assert(status == CUBOOL_STATUS_SUCCESS);
+
+    return from_pairs(nrows, ncols, rows.data(), cols.data(), nvals, transposed);
+  }
+};
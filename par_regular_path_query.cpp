@@ -7,6 +7,7 @@
 #include <ranges>
 
 #include "regular_path_query.hpp"
+#include "par_regular_path_query.hpp"
 #include "timer.hpp"
 
 #include "BS_thread_pool.hpp"
@@ -21,8 +22,11 @@ cuBool_Matrix par_regular_path_query_with_transposed(
   const std::vector<cuBool_Matrix> &automat_transposed,
 
   const std::vector<bool> &inversed_labels_input, bool all_labels_are_inversed,
+  const std::vector<const CsrAdjacency *> &graph_adjacency,
+  const QueryBudget &budget, QueryStatus &query_status, std::size_t threads_number,
   std::optional<std::reference_wrapper<std::ostream>> out) {
   cuBool_Status status;
+  query_status = QueryStatus::Ok;
 
   auto inversed_labels = inversed_labels_input;
   inversed_labels.resize(std::max(graph.size(), automat.size()));
@@ -99,13 +103,81 @@ cuBool_Matrix par_regular_path_query_with_transposed(
     assert(status == CUBOOL_STATUS_SUCCESS);
   }
 
-  BS::thread_pool pool;
+  BS::thread_pool pool(threads_number == 0 ? std::thread::hardware_concurrency()
+                                            : threads_number);
   std::vector<std::future<cuBool_Status>> futures;
   futures.reserve(label_number);
 
+#ifdef RPQ_RUN_ON_CPU
+  // on CPU query usually touches only a few labels, so every label product
+  // is split between all workers instead
+  std::vector<const CsrAdjacency *> label_adjacency(label_number, nullptr);
+  std::vector<CsrAdjacency> own_adjacency(label_number);
+  std::vector<ParallelMxmScratch> label_scratch(label_number);
+  for (int i = 0; i < label_number; i++) {
+    if (graph[i] == nullptr || automat[i] == nullptr) {
+      continue;
+    }
+    if (i < graph_adjacency.size() && graph_adjacency[i] != nullptr &&
+        !graph_adjacency[i]->empty()) {
+      label_adjacency[i] = graph_adjacency[i];
+      continue;
+    }
+    own_adjacency[i] = CsrAdjacency::from_matrix(graph[i], inversed_labels[i]);
+    label_adjacency[i] = &own_adjacency[i];
+  }
+#endif
+
+  Timer budget_timer {};
+  double elapsed = 0;
+  uint64_t iterations = 0;
+
+  // approximate size of matrix in CSR format
+  auto matrix_bytes = [](cuBool_Matrix matrix) {
+    cuBool_Index nrows = 0, nvals = 0;
+    cuBool_Matrix_Nrows(matrix, &nrows);
+    cuBool_Matrix_Nvals(matrix, &nvals);
+    return (uint64_t(nrows) + 1 + nvals) * sizeof(cuBool_Index);
+  };
+
   while (states > 0) {
+    elapsed += budget_timer.measure();
+    uint64_t scratch_bytes = 0;
+    if (budget._max_scratch_bytes != 0) {
+      for (auto matrix : result_label_matrices) {
+        scratch_bytes += matrix_bytes(matrix);
+      }
+      for (auto matrix : util_label_matrices) {
+        scratch_bytes += matrix_bytes(matrix);
+      }
+      scratch_bytes += matrix_bytes(next_frontier) + matrix_bytes(reacheble);
+    }
+    query_status = budget.check(iterations, states, scratch_bytes, elapsed);
+    if (query_status != QueryStatus::Ok) {
+      break;
+    }
+    iterations++;
+
     std::swap(frontier, next_frontier);
 
+#ifdef RPQ_RUN_ON_CPU
+    for (int i = 0; i < label_number; i++) {
+      if (graph[i] == nullptr || automat[i] == nullptr) {
+        continue;
+      }
+
+      auto result = result_label_matrices[i];
+      auto util = util_label_matrices[i];
+
+      cuBool_Matrix automat_matrix = all_labels_are_inversed ? automat[i] : automat_transposed[i];
+      status = cuBool_MxM(util, automat_matrix, frontier, CUBOOL_HINT_NO);
+      assert(status == CUBOOL_STATUS_SUCCESS);
+
+      // we want: next_frontier += (symbol_frontier * graph[i]) & (!reachible)
+      status = parallel_mxm(result, util, *label_adjacency[i], label_scratch[i], pool);
+      assert(status == CUBOOL_STATUS_SUCCESS);
+    }
+#else
     futures.clear();
     for (int i = 0; i < label_number; i++) {
       if (graph[i] == nullptr || automat[i] == nullptr) {
@@ -115,7 +187,7 @@ cuBool_Matrix par_regular_path_query_with_transposed(
       futures.push_back(pool.submit_task(
         [&, result = result_label_matrices[i], util = util_label_matrices[i], i]() mutable {
           cuBool_Matrix automat_matrix = all_labels_are_inversed ? automat[i] : automat_transposed[i];
-          status = cuBool_MxM(util, automat_matrix, frontier, CUBOOL_HINT_NO);
+          cuBool_Status status = cuBool_MxM(util, automat_matrix, frontier, CUBOOL_HINT_NO);
           if (status != CUBOOL_STATUS_SUCCESS) {
             return status;
           }
@@ -135,6 +207,7 @@ cuBool_Matrix par_regular_path_query_with_transposed(
       status = future.get();
       assert(status == CUBOOL_STATUS_SUCCESS);
     }
+#endif
 
     auto size = result_label_matrices.size();
     while (size > 1) {
@@ -168,7 +241,8 @@ cuBool_Matrix par_regular_path_query_with_transposed(
 
   if (out.has_value()) {
     auto &out_value = out.value().get();
-    std::println(out_value, "load time = {}, execute_time = {}", load_time, rpq_timer.measure());
+    std::println(out_value, "load time = {}, execute_time = {}, iterations = {}, status = {}",
+                 load_time, rpq_timer.measure(), iterations, to_string(query_status));
   }
 
   // free matrix necessary for algorithm
@@ -186,6 +260,11 @@ cuBool_Matrix par_regular_path_query_with_transposed(
   cuBool_Matrix_Free(frontier);
   cuBool_Matrix_Free(symbol_frontier);
 
+  if (query_status != QueryStatus::Ok) {
+    cuBool_Matrix_Free(reacheble);
+    return nullptr;
+  }
+
   return reacheble;
 }
 
@@ -196,12 +275,15 @@ cuBool_Matrix par_regular_path_query(
   const std::vector<cuBool_Matrix> &automat, const std::vector<cuBool_Index> &start_states,
   // work with inverted labels
   const std::vector<bool> &inversed_labels_input, bool all_labels_are_inversed,
+  // limits of query
+  const QueryBudget &budget, QueryStatus &query_status, std::size_t threads_number,
   // for debug
   std::optional<std::reference_wrapper<std::ostream>> out) {
   cuBool_Status status;
 
-  // transpose graph matrices
+  // transpose graph matrices, CPU builds multiply by adjacency built from graph itself
   std::vector<cuBool_Matrix> graph_transposed;
+#ifndef RPQ_RUN_ON_CPU
   graph_transposed.reserve(graph.size());
   for (uint32_t i = 0; i < graph.size(); i++) {
     graph_transposed.emplace_back();
@@ -220,6 +302,7 @@ cuBool_Matrix par_regular_path_query(
     status = cuBool_Matrix_Transpose(graph_transposed.back(), label_matrix, CUBOOL_HINT_NO);
     assert(status == CUBOOL_STATUS_SUCCESS);
   }
+#endif
 
   // transpose automat matrices
   std::vector<cuBool_Matrix> automat_transposed;
@@ -245,7 +328,7 @@ cuBool_Matrix par_regular_path_query(
     automat, start_states,
     graph_transposed, automat_transposed,
     inversed_labels_input, all_labels_are_inversed,
-    out);
+    {}, budget, query_status, threads_number, out);
 
   for (cuBool_Matrix matrix : graph_transposed) {
     if (matrix != nullptr) {
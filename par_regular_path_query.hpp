@@ -0,0 +1,45 @@
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <ostream>
+#include <vector>
+
+#include <cubool/cubool.h>
+
+#include "parallel_mxm.hpp"
+#include "query_budget.hpp"
+
+// Level-synchronous matrix engine parallel over labels (and inside every label product
+// on CPU builds). Budget is checked between iterations: if it is exceeded, scratch
+// matrices are freed, query_status is set and nullptr is returned.
+// threads_number = 0 means all hardware threads.
+
+cuBool_Matrix par_regular_path_query_with_transposed(
+  // vector of sparse graph matrices for each label
+  const std::vector<cuBool_Matrix> &graph, const std::vector<cuBool_Index> &source_vertices,
+  // vector of sparse automat matrices for each label
+  const std::vector<cuBool_Matrix> &automat, const std::vector<cuBool_Index> &start_states,
+  // transposed matrices for graph and automat
+  const std::vector<cuBool_Matrix> &graph_transposed,
+  const std::vector<cuBool_Matrix> &automat_transposed,
+  const std::vector<bool> &inversed_labels_input, bool all_labels_are_inversed,
+  // host adjacency of graph matrices oriented in traverse direction, used on CPU builds
+  // instead of graph_transposed; adjacency of labels absent here is built on every call
+  const std::vector<const CsrAdjacency *> &graph_adjacency,
+  // limits of query
+  const QueryBudget &budget, QueryStatus &query_status, std::size_t threads_number = 0,
+  // for debug
+  std::optional<std::reference_wrapper<std::ostream>> out = std::nullopt);
+
+cuBool_Matrix par_regular_path_query(
+  // vector of sparse graph matrices for each label
+  const std::vector<cuBool_Matrix> &graph, const std::vector<cuBool_Index> &source_vertices,
+  // vector of sparse automat matrices for each label
+  const std::vector<cuBool_Matrix> &automat, const std::vector<cuBool_Index> &start_states,
+  // work with inverted labels
+  const std::vector<bool> &inversed_labels_input, bool all_labels_are_inversed,
+  // limits of query
+  const QueryBudget &budget, QueryStatus &query_status, std::size_t threads_number = 0,
+  // for debug
+  std::optional<std::reference_wrapper<std::ostream>> out = std::nullopt);
@@ -0,0 +1,148 @@
+#include <algorithm>
+
+#include "parallel_mxm.hpp"
+
+cuBool_Status parallel_mxm(cuBool_Matrix result, cuBool_Matrix left, const CsrAdjacency &right,
+                           ParallelMxmScratch &scratch, BS::thread_pool &pool) {
+  cuBool_Status status;
+
+  cuBool_Index left_nrows = 0, left_ncols = 0, left_nvals = 0;
+  cuBool_Matrix_Nrows(left, &left_nrows);
+  cuBool_Matrix_Ncols(left, &left_ncols);
+  cuBool_Matrix_Nvals(left, &left_nvals);
+  if (left_ncols != right._nrows) {
+    return CUBOOL_STATUS_INVALID_ARGUMENT;
+  }
+
+  auto &rows = scratch._rows;
+  auto &cols = scratch._cols;
+  rows.resize(left_nvals);
+  cols.resize(left_nvals);
+  status = cuBool_Matrix_ExtractPairs(left, rows.data(), cols.data(), &left_nvals);
+  if (status != CUBOOL_STATUS_SUCCESS) {
+    return status;
+  }
+  scratch._left = CsrAdjacency::from_pairs(left_nrows, left_ncols, rows.data(), cols.data(),
+                                           left_nvals);
+  const auto &left_csr = scratch._left;
+
+  // few tasks per worker to smooth skew between vertex degrees
+  const std::size_t tasks_number = std::max<std::size_t>(pool.get_thread_count(), 1) * 4;
+
+  // every chunk gathers neighbours of its nonzeros row by row and sorts them
+  const std::size_t chunks_number =
+    std::clamp<std::size_t>(tasks_number, 1, std::max<cuBool_Index>(left_nvals, 1));
+  auto &chunks = scratch._chunks;
+  chunks.resize(chunks_number);
+  for (std::size_t c = 0; c < chunks_number; c++) {
+    pool.detach_task([&, c]() {
+      const auto &offsets = left_csr._offsets;
+      uint64_t begin = uint64_t(left_nvals) * c / chunks_number;
+      uint64_t end = uint64_t(left_nvals) * (c + 1) / chunks_number;
+
+      auto &chunk = chunks[c];
+      chunk._rows.clear();
+      chunk._offsets.assign(1, 0);
+      chunk._cols.clear();
+      if (begin == end) {
+        return;
+      }
+
+      cuBool_Index row = std::upper_bound(offsets.begin(), offsets.end(), begin) -
+                         offsets.begin() - 1;
+      for (uint64_t i = begin; i < end;) {
+        while (offsets[row + 1] <= i) {
+          row++;
+        }
+        uint64_t row_end = std::min(end, offsets[row + 1]);
+
+        auto first = chunk._cols.size();
+        for (; i < row_end; i++) {
+          auto neighbours = right.neighbours(left_csr._columns[i]);
+          chunk._cols.insert(chunk._cols.end(), neighbours.begin(), neighbours.end());
+        }
+        std::sort(chunk._cols.begin() + first, chunk._cols.end());
+        chunk._cols.erase(std::unique(chunk._cols.begin() + first, chunk._cols.end()),
+                          chunk._cols.end());
+
+        if (chunk._cols.size() > first) {
+          chunk._rows.push_back(row);
+          chunk._offsets.push_back(chunk._cols.size());
+        }
+      }
+    });
+  }
+  pool.wait();
+
+  // chunks cover consecutive nonzeros, so only rows on chunk borders have several parts
+  auto &row_parts = scratch._row_parts;
+  row_parts.resize(left_nrows);
+  for (auto &parts : row_parts) {
+    parts.clear();
+  }
+  for (std::size_t c = 0; c < chunks_number; c++) {
+    for (std::size_t j = 0; j < chunks[c]._rows.size(); j++) {
+      row_parts[chunks[c]._rows[j]].emplace_back(c, j);
+    }
+  }
+
+  // parts of every row are merged independently inside every column range,
+  // so every range task produces ordered slices of all rows
+  const cuBool_Index right_ncols = right._ncols;
+  const std::size_t ranges_number =
+    std::clamp<std::size_t>(tasks_number, 1, std::max<cuBool_Index>(right_ncols, 1));
+  const cuBool_Index range_size = (right_ncols + ranges_number - 1) / ranges_number;
+  auto &ranges = scratch._ranges;
+  ranges.resize(ranges_number);
+  auto &positions = scratch._positions;
+  positions.assign(std::size_t(left_nrows) * ranges_number + 1, 0);
+
+  for (std::size_t k = 0; k < ranges_number; k++) {
+    pool.detach_task([&, k]() {
+      cuBool_Index range_begin = std::min<uint64_t>(uint64_t(range_size) * k, right_ncols);
+      cuBool_Index range_end = std::min<uint64_t>(uint64_t(range_size) * (k + 1), right_ncols);
+
+      auto &range = ranges[k];
+      range.clear();
+      for (cuBool_Index row = 0; row < left_nrows; row++) {
+        auto first = range.size();
+        for (auto [c, j] : row_parts[row]) {
+          const auto &chunk = chunks[c];
+          auto part_begin = chunk._cols.begin() + chunk._offsets[j];
+          auto part_end = chunk._cols.begin() + chunk._offsets[j + 1];
+          range.insert(range.end(), std::lower_bound(part_begin, part_end, range_begin),
+                       std::lower_bound(part_begin, part_end, range_end));
+        }
+        if (row_parts[row].size() > 1) {
+          std::sort(range.begin() + first, range.end());
+          range.erase(std::unique(range.begin() + first, range.end()), range.end());
+        }
+        positions[std::size_t(row) * ranges_number + k + 1] = range.size() - first;
+      }
+    });
+  }
+  pool.wait();
+
+  for (std::size_t i = 1; i < positions.size(); i++) {
+    positions[i] += positions[i - 1];
+  }
+  rows.resize(positions.back());
+  cols.resize(positions.back());
+
+  for (std::size_t k = 0; k < ranges_number; k++) {
+    pool.detach_task([&, k]() {
+      auto source = ranges[k].begin();
+      for (cuBool_Index row = 0; row < left_nrows; row++) {
+        auto position = positions[std::size_t(row) * ranges_number + k];
+        auto count = positions[std::size_t(row) * ranges_number + k + 1] - position;
+        std::copy(source, source + count, cols.begin() + position);
+        std::fill(rows.begin() + position, rows.begin() + position + count, row);
+        source += count;
+      }
+    });
+  }
+  pool.wait();
+
+  return cuBool_Matrix_Build(result, rows.data(), cols.data(), rows.size(),
+                             CUBOOL_HINT_VALUES_SORTED | CUBOOL_HINT_NO_DUPLICATES);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <cubool/cubool.h>
+
+#include "BS_thread_pool.hpp"
+#include "csr_adjacency.hpp"
+
+// Sorted unique product columns of left rows touched by one chunk of left nonzeros.
+struct ParallelMxmChunk {
+  std::vector<cuBool_Index> _rows;
+  std::vector<uint64_t> _offsets;
+  std::vector<cuBool_Index> _cols;
+};
+
+// Per query buffers of parallel_mxm, reused between iterations.
+// Everything here is proportional to nonzeros of operands and product, not to graph size.
+struct ParallelMxmScratch {
+  CsrAdjacency _left;
+  std::vector<ParallelMxmChunk> _chunks;
+  // (chunk, row index in chunk) of every part of left row, in chunk order
+  std::vector<std::vector<std::pair<std::size_t, std::size_t>>> _row_parts;
+  // product columns of every column range, row by row
+  std::vector<std::vector<cuBool_Index>> _ranges;
+  // number of columns of every (row, range), then position of it in output
+  std::vector<uint64_t> _positions;
+  // output pairs, ordered by row and then by column
+  std::vector<cuBool_Index> _rows, _cols;
+};
+
+// result = left * right on host, split between workers of pool.
+// Left nonzeros are split into equal chunks, every chunk writes sorted unique columns
+// of its rows, then rows shared by neighbour chunks are merged by column ranges.
+// Output comes ordered, so result is built without sorting.
+// Left is frontier-like: few rows (automat states) over graph vertices.
+cuBool_Status parallel_mxm(cuBool_Matrix result, cuBool_Matrix left, const CsrAdjacency &right,
+                           ParallelMxmScratch &scratch, BS::thread_pool &pool);
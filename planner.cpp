@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <bit>
+#include <cassert>
+
+#include "planner.hpp"
+
+LabelStatistics LabelStatistics::collect(cuBool_Index nodes, const cuBool_Index *rows,
+                                         const cuBool_Index *cols, uint64_t nvals) {
+  LabelStatistics statistics;
+  statistics._nodes = nodes;
+  statistics._nnz = nvals;
+
+  std::vector<cuBool_Index> out_degree(nodes, 0), in_degree(nodes, 0);
+  for (uint64_t i = 0; i < nvals; i++) {
+    assert(rows[i] < nodes && cols[i] < nodes);
+    out_degree[rows[i]]++;
+    in_degree[cols[i]]++;
+  }
+
+  auto fill = [](const std::vector<cuBool_Index> &degree, cuBool_Index &distinct,
+                 cuBool_Index &max_degree, std::array<uint64_t, 32> &histogram) {
+    for (auto value : degree) {
+      if (value == 0) {
+        continue;
+      }
+      distinct++;
+      max_degree = std::max(max_degree, value);
+      histogram[std::bit_width(value) - 1]++;
+    }
+  };
+  fill(out_degree, statistics._distinct_sources, statistics._max_out_degree,
+       statistics._out_degree_histogram);
+  fill(in_degree, statistics._distinct_targets, statistics._max_in_degree,
+       statistics._in_degree_histogram);
+
+  return statistics;
+}
+
+double LabelStatistics::branching(bool backward) const {
+  if (_nnz == 0 || _nodes == 0) {
+    return 0;
+  }
+
+  const auto &histogram = backward ? _in_degree_histogram : _out_degree_histogram;
+  const auto distinct = backward ? _distinct_targets : _distinct_sources;
+
+  // frontier vertices are reached by edges, so they are biased to high degree:
+  // use size-biased mean E[d^2] / E[d] over degree buckets
+  double sum = 0, square_sum = 0;
+  for (std::size_t i = 0; i < histogram.size(); i++) {
+    double degree = i == 0 ? 1.0 : 1.5 * double(uint64_t(1) << i);
+    sum += histogram[i] * degree;
+    square_sum += histogram[i] * degree * degree;
+  }
+  if (sum == 0) {
+    return 0;
+  }
+
+  // only part of vertices have edges of this label at all
+  double has_edges = double(distinct) / _nodes;
+  return has_edges * (square_sum / sum);
+}
+
+namespace {
+
+// estimated number of graph edges visited while frontier spreads over automat
+double estimate_cost(const std::vector<const CsrAdjacency *> &automat,
+                     const std::vector<const LabelStatistics *> &labels,
+                     const std::vector<bool> &inversed_labels,
+                     const std::vector<cuBool_Index> &initial_states, bool backward) {
+  cuBool_Index states_number = 0;
+  cuBool_Index nodes = 0;
+  for (std::size_t i = 0; i < automat.size(); i++) {
+    if (automat[i] != nullptr && labels[i] != nullptr) {
+      states_number = std::max(states_number, automat[i]->_nrows);
+      nodes = std::max(nodes, labels[i]->_nodes);
+    }
+  }
+  if (states_number == 0) {
+    return 0;
+  }
+
+  // expected frontier size in every automat state
+  std::vector<double> frontier(states_number, 0), next_frontier(states_number, 0);
+  for (auto state : initial_states) {
+    if (state < states_number) {
+      frontier[state] = 1;
+    }
+  }
+
+  // loops in automat run up to graph diameter, which is unknown here,
+  // frontier is capped by graph size instead so cost saturates
+  const cuBool_Index iterations = std::max<cuBool_Index>(4, states_number * 2);
+
+  double cost = 0;
+  for (cuBool_Index iteration = 0; iteration < iterations; iteration++) {
+    std::fill(next_frontier.begin(), next_frontier.end(), 0);
+
+    for (std::size_t i = 0; i < automat.size(); i++) {
+      if (automat[i] == nullptr || labels[i] == nullptr) {
+        continue;
+      }
+      const auto &statistics = *labels[i];
+      bool graph_backward = inversed_labels[i] != backward;
+      double branching = statistics.branching(graph_backward);
+      double reachable = graph_backward ? statistics._distinct_sources
+                                        : statistics._distinct_targets;
+
+      for (cuBool_Index from = 0; from < automat[i]->_nrows; from++) {
+        for (auto to : automat[i]->neighbours(from)) {
+          auto current = backward ? to : from;
+          auto next = backward ? from : to;
+          double edges = frontier[current] * branching;
+          cost += edges;
+          next_frontier[next] += std::min(edges, reachable);
+        }
+      }
+    }
+
+    double total = 0;
+    for (auto &size : next_frontier) {
+      size = std::min<double>(size, nodes);
+      total += size;
+    }
+    std::swap(frontier, next_frontier);
+    if (total == 0) {
+      break;
+    }
+  }
+
+  return cost;
+}
+
+}  // namespace
+
+QueryPlan plan_query(const std::vector<const CsrAdjacency *> &automat,
+                     const std::vector<const LabelStatistics *> &labels,
+                     const std::vector<bool> &inversed_labels,
+                     const std::vector<cuBool_Index> &start_states,
+                     const std::vector<cuBool_Index> &final_states) {
+  assert(automat.size() == labels.size() && automat.size() == inversed_labels.size());
+
+  QueryPlan plan;
+  plan._forward_cost = estimate_cost(automat, labels, inversed_labels, start_states, false);
+  plan._backward_cost = estimate_cost(automat, labels, inversed_labels, final_states, true);
+  plan._direction = plan._backward_cost < plan._forward_cost ? QueryDirection::Backward
+                                                             : QueryDirection::Forward;
+  return plan;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <cubool/cubool.h>
+
+#include "csr_adjacency.hpp"
+
+// per label statistics collected once at load time
+struct LabelStatistics {
+  cuBool_Index _nodes = 0;
+  uint64_t _nnz = 0;
+  cuBool_Index _distinct_sources = 0, _distinct_targets = 0;
+  cuBool_Index _max_out_degree = 0, _max_in_degree = 0;
+
+  // bucket i counts vertices with degree in [2^i, 2^(i + 1))
+  std::array<uint64_t, 32> _out_degree_histogram {}, _in_degree_histogram {};
+
+  static LabelStatistics collect(cuBool_Index nodes, const cuBool_Index *rows,
+                                 const cuBool_Index *cols, uint64_t nvals);
+
+  // expected number of edges followed from one frontier vertex,
+  // backward means edges are walked from target to source
+  double branching(bool backward) const;
+};
+
+enum class QueryDirection {
+  // from source vertex and start states
+  Forward,
+  // from dest vertex and final states over inversed labels
+  Backward,
+};
+
+struct QueryPlan {
+  QueryDirection _direction = QueryDirection::Forward;
+  double _forward_cost = 0, _backward_cost = 0;
+};
+
+// automat[i] - automat transitions of i-th query label (as stored, not transposed),
+// labels[i] - statistics of its graph label, inversed_labels[i] - label is used inversed
+QueryPlan plan_query(const std::vector<const CsrAdjacency *> &automat,
+                     const std::vector<const LabelStatistics *> &labels,
+                     const std::vector<bool> &inversed_labels,
+                     const std::vector<cuBool_Index> &start_states,
+                     const std::vector<cuBool_Index> &final_states);
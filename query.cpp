@@ -0,0 +1,776 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <print>
+
+#include <fast_matrix_market/fast_matrix_market.hpp>
+
+#include "query.hpp"
+#include "closure_index.hpp"
+#include "async_regular_path_query.hpp"
+#include "par_regular_path_query.hpp"
+
+bool MatrixData::load_to_cpu(std::string_view filename) {
+  if (_loaded) {
+    return true;
+  }
+
+  std::ifstream file(filename.data());
+  if (not file) {
+    return false;
+  }
+
+  std::vector<bool> vals;
+  fast_matrix_market::read_matrix_market_triplet(file, _nrows, _ncols, _rows, _cols, vals);
+  _nvals = vals.size();
+  _loaded = true;
+
+  return true;
+}
+
+bool MatrixData::copy_to_gpu(cuBool_Matrix *matrix) const {
+  cuBool_Status status = CUBOOL_STATUS_SUCCESS;
+
+  status = cuBool_Matrix_New(matrix, _nrows, _ncols);
+  if (status != CUBOOL_STATUS_SUCCESS) {
+    return false;
+  }
+
+  status =
+    cuBool_Matrix_Build(*matrix, rows(), cols(), _nvals, CUBOOL_HINT_NO);
+  if (status != CUBOOL_STATUS_SUCCESS) {
+    return false;
+  }
+
+  return true;
+}
+
+std::vector<uint32_t> read_query_labels(uint32_t query_number) {
+  std::vector<uint32_t> labels;
+
+  std::string filename = std::format("{}{}{}/meta.txt", BENCH_DATASET_DIR, "/Queries/", query_number);
+  std::ifstream query_file(filename);
+  if (not query_file) {
+    return labels;
+  }
+
+  // read sourse and dest, Query::load runs queries without them from vertex 1,
+  // so their labels are needed too
+  int tmp1, tmp2;
+  query_file >> tmp1 >> tmp2;
+
+  // read start vertices and start states
+  for (int _ = 0; _ < 2; _++) {
+    query_file >> tmp1;
+    for (int i = 0; i < tmp1; i++) {
+      query_file >> tmp2;
+    }
+  }
+
+  uint32_t labels_number = 0;
+  query_file >> labels_number;
+  for (int i = 0; i < labels_number; i++) {
+    int label;
+    query_file >> label;
+    labels.push_back(std::abs(label));
+  }
+
+  return labels;
+}
+
+Wikidata load_matrices(bool load_at_gpu, bool pretransposed, bool build_adjacency,
+                       bool collect_statistics, ClosureIndex *closure_index) {
+  std::vector<std::vector<uint32_t>> closure_sets;
+  if (closure_index != nullptr) {
+    closure_sets = read_closure_config(std::format("{}/closures.txt", BENCH_DATASET_DIR));
+  }
+
+  // closures are stored after graph labels
+  Wikidata matrices(BENCH_LABEL_COUNT + 1 + closure_sets.size());
+  Timer load_matrices_timer {};
+
+  load_matrices_timer.mark();
+  std::cout << "loading at RAM\n";
+  for (uint32_t query_number = 1; query_number <= BENCH_QUERY_COUNT; query_number++) {
+    std::cout << "\rloaded query # " << query_number;
+    std::flush(std::cout);
+
+    for (auto label : read_query_labels(query_number)) {
+      std::string filename = std::format("{}{}{}.txt", BENCH_DATASET_DIR, "/Graph/", label);
+      matrices[label].load_to_cpu(filename);
+    }
+  }
+  std::cout << "\r";
+  double elapsed = load_matrices_timer.measure();
+  std::cout << "matrices loaded, time: " << elapsed << "s\n";
+
+  if (!closure_sets.empty()) {
+    load_matrices_timer.mark();
+    std::filesystem::create_directory(std::format("{}/Closures", BENCH_DATASET_DIR));
+    for (std::size_t i = 0; i < closure_sets.size(); i++) {
+      const auto &labels = closure_sets[i];
+      if (labels.back() > BENCH_LABEL_COUNT) {
+        std::println("closure over label {} skipped: no such label", labels.back());
+        continue;
+      }
+
+      std::string name;
+      for (auto label : labels) {
+        name += std::format("{}{}", name.empty() ? "" : "_", label);
+      }
+
+      uint32_t index = BENCH_LABEL_COUNT + 1 + i;
+      auto &closure = matrices[index];
+      std::string filename = std::format("{}/Closures/{}.txt", BENCH_DATASET_DIR, name);
+      if (!closure.load_to_cpu(filename)) {
+        for (auto label : labels) {
+          auto graph_filename = std::format("{}{}{}.txt", BENCH_DATASET_DIR, "/Graph/", label);
+          matrices[label].load_to_cpu(graph_filename);
+        }
+        auto scratch_mb = build_closure(matrices, labels, closure) / 1'000'000.0;
+        closure_index->_build_scratch_mb = std::max(closure_index->_build_scratch_mb, scratch_mb);
+        if (!save_matrix_market(closure, filename)) {
+          std::println("failed to save closure {}", filename);
+        }
+      }
+
+      closure_index->_closures[labels] = index;
+      closure_index->_size_mb += closure.sizeMb();
+      std::println("closure {}: nnz = {}, size = {}Mb", name, closure._nvals, closure.sizeMb());
+    }
+    closure_index->_build_time = load_matrices_timer.measure();
+    std::println("closure index ready, time: {}s, size: {}Mb, build scratch: {}Mb",
+                 closure_index->_build_time, closure_index->_size_mb,
+                 closure_index->_build_scratch_mb);
+  }
+
+  if (collect_statistics) {
+    load_matrices_timer.mark();
+    for (auto &data : matrices) {
+      if (data._loaded) {
+        data._statistics = LabelStatistics::collect(std::max(data._nrows, data._ncols),
+                                                    data.rows(), data.cols(), data._nvals);
+      }
+    }
+    elapsed = load_matrices_timer.measure();
+    std::println("label statistics collected, time: {}s", elapsed);
+  }
+
+  if (build_adjacency) {
+    load_matrices_timer.mark();
+    for (auto &data : matrices) {
+      if (data._loaded) {
+        data.build_adjacency();
+      }
+    }
+    elapsed = load_matrices_timer.measure();
+    std::println("adjacency built, time: {}s", elapsed);
+  }
+
+  if (load_at_gpu) {
+    load_matrices_timer.mark();
+    std::println("loading at VRAM");
+    uint32_t initial_free_mem = get_used_memory();
+    for (int i = 0; i < matrices.size(); i++) {
+      uint32_t free_mem = get_used_memory();
+
+      auto &data = matrices[i];
+      if (!data._loaded) {
+        continue;
+      }
+
+      data.prepare();
+
+      if (pretransposed && data._matrix != nullptr) {
+        cuBool_Index nrows, ncols;
+        cuBool_Matrix_Nrows(data._matrix, &nrows);
+        cuBool_Matrix_Ncols(data._matrix, &ncols);
+
+        cuBool_Matrix_New(&data._transposed, ncols, nrows);
+        cuBool_Matrix_Transpose(data._transposed, data._matrix, CUBOOL_HINT_NO);
+      }
+
+      uint32_t new_free_mem = get_used_memory();
+      std::print("\r");
+      std::print("matrix #{}: now used: {}, diff used: {}, actual size: {}", i, new_free_mem,
+                 new_free_mem - free_mem, data.sizeMb());
+      std::flush(std::cout);
+    }
+    elapsed = load_matrices_timer.measure();
+    std::print("\r");
+    std::println("matrices loaded at GPU, time: {}s, used memory: {}",
+                  elapsed, get_used_memory() - initial_free_mem);
+  }
+
+  return matrices;
+}
+
+std::pair<bool, double> Query::load(uint32_t query_number, const Wikidata &matrices,
+                                    bool preloaded, bool transpose, bool pretransposed) {
+  _query_timer.mark();
+  _query_number = query_number;
+
+  std::string filename = std::format("{}{}{}/meta.txt", BENCH_DATASET_DIR, "/Queries/", query_number);
+  std::ifstream query_file(filename);
+  if (!query_file) {
+    return {false, 0};
+  }
+
+  cuBool_Index source = 0, dest = 0;
+  query_file >> source >> dest;
+  if (source == 0 && dest == 0) {
+    source = 1;
+    // return {false, 0};
+  }
+  source--;
+  dest--;
+
+  uint32_t src_verts_number = 0;
+  query_file >> src_verts_number;
+  std::vector<cuBool_Index> src_verts(src_verts_number);
+  for (auto &vert : src_verts) {
+    query_file >> vert;
+    vert--;
+  }
+
+  uint32_t inv_src_vert_number = 0;
+  query_file >> inv_src_vert_number;
+  std::vector<cuBool_Index> inv_src_verts(src_verts_number);
+  for (auto &vert : inv_src_verts) {
+    query_file >> vert;
+    vert--;
+  }
+
+  uint32_t labels_number = 0;
+  query_file >> labels_number;
+  _labels.resize(labels_number);
+  _inverse_lables.resize(labels_number);
+  for (int i = 0; i < labels_number; i++) {
+    int label;
+    query_file >> label;
+    _labels[i] = std::abs(label);
+    _inverse_lables[i] = label < 0;
+  }
+
+  _graph.assign(labels_number, nullptr);
+  _automat.assign(labels_number, nullptr);
+
+  _matrices_was_loaded = !preloaded;
+  _transposed = transpose;
+
+  for (int i = 0; i < labels_number; i++) {
+    uint32_t label = _labels[i];
+    if (!preloaded) {
+      if (not matrices[label].copy_to_gpu(&_graph[i])) {
+        return {false, 0};
+      }
+    } else {
+      _graph[i] = matrices[label]._matrix;
+    }
+
+    filename = std::format("{}{}{}/{}.txt", BENCH_DATASET_DIR, "/Queries/", query_number,
+                           _inverse_lables[i] ? -(int)label : (int)label);
+    MatrixData data;
+    if (not data.load_to_cpu(filename) || not data.copy_to_gpu(&_automat[i])) {
+      return {false, 0};
+    }
+  }
+
+  if (_closure_index != nullptr &&
+      !substitute_closures(matrices, src_verts, inv_src_verts, preloaded)) {
+    return {false, 0};
+  }
+  labels_number = _labels.size();
+
+  if (transpose) {
+#ifdef RPQ_RUN_ON_CPU
+    // CPU label products read graph through adjacency, transposed copies are never used
+    _graph_transposed.assign(_graph.size(), nullptr);
+#else
+    _graph_transposed.reserve(_graph.size());
+    if (!pretransposed) {
+      for (auto label_matrix : _graph) {
+        _graph_transposed.emplace_back();
+
+        if (label_matrix == nullptr) {
+          continue;
+        }
+
+        cuBool_Index nrows, ncols;
+        cuBool_Matrix_Nrows(label_matrix, &nrows);
+        cuBool_Matrix_Ncols(label_matrix, &ncols);
+
+        cuBool_Matrix_New(&_graph_transposed.back(), ncols, nrows);
+        cuBool_Matrix_Transpose(_graph_transposed.back(), label_matrix, CUBOOL_HINT_NO);
+      }
+    } else {
+      for (int i = 0; i < labels_number; i++) {
+        uint32_t label = _labels[i];
+        _graph_transposed[i] = matrices[label]._transposed;
+      }
+    }
+#endif
+
+    // transpose automat matrices
+    _automat_transposed.reserve(_automat.size());
+    for (auto label_matrix : _automat) {
+      _automat_transposed.emplace_back();
+      if (label_matrix == nullptr) {
+        continue;
+      }
+
+      cuBool_Index nrows, ncols;
+      cuBool_Matrix_Nrows(label_matrix, &nrows);
+      cuBool_Matrix_Ncols(label_matrix, &ncols);
+
+      cuBool_Matrix_New(&_automat_transposed.back(), ncols, nrows);
+      cuBool_Matrix_Transpose(_automat_transposed.back(), label_matrix, CUBOOL_HINT_NO);
+    }
+  }
+
+  constexpr auto unbound = std::numeric_limits<cuBool_Index>::max();
+
+  bool backward = source == unbound;
+  if (_use_planner) {
+    _plan = plan_direction(matrices, src_verts, inv_src_verts);
+    // for pair query both directions give the same reachability,
+    // otherwise direction is fixed by query and plan is only logged
+    if (source != unbound && dest != unbound) {
+      backward = _plan._direction == QueryDirection::Backward;
+    }
+  }
+  _target_vertex.reset();
+  if (source != unbound && dest != unbound) {
+    _target_vertex = backward ? source : dest;
+  }
+
+  if (backward) {
+    _start_states = std::move(inv_src_verts);
+    _final_states = std::move(src_verts);
+    _sourece_vertices = std::vector {dest};
+    _labels_inversed = true;
+  } else {
+    _start_states = std::move(src_verts);
+    _final_states = std::move(inv_src_verts);
+    _sourece_vertices = std::vector {source};
+    _labels_inversed = false;
+  }
+
+  // async engine walks oriented adjacency, matrix engine on CPU builds multiplies by it
+  _graph_adjacency.assign(labels_number, nullptr);
+  for (int i = 0; i < labels_number; i++) {
+    const auto &data = matrices[_labels[i]];
+    if (data._adjacency.empty()) {
+      continue;
+    }
+    bool inversed = _inverse_lables[i] ^ _labels_inversed;
+    _graph_adjacency[i] = inversed ? &data._adjacency_transposed : &data._adjacency;
+  }
+  if (_engine == RpqEngine::Async && std::ranges::count(_graph_adjacency, nullptr) != 0) {
+    // adjacency was not prebuilt, engine will extract it from matrices
+    _graph_adjacency.clear();
+  }
+
+  return {true, _query_timer.measure()};
+}
+
+// State with self loops over exactly indexed label set L is split:
+// transitions into it go to new entry state, which has closure L+ transition
+// to the original state and copies of its outgoing transitions (zero loops case).
+// Self loops are dropped, so fixpoint over L is replaced by one multiplication.
+bool Query::substitute_closures(const Wikidata &matrices, std::vector<cuBool_Index> &start_states,
+                                std::vector<cuBool_Index> &final_states, bool preloaded) {
+  if (_automat.empty()) {
+    return true;
+  }
+
+  cuBool_Index states_number = 0;
+  cuBool_Matrix_Nrows(_automat.front(), &states_number);
+
+  using Transition = std::pair<cuBool_Index, cuBool_Index>;
+  std::vector<std::vector<Transition>> transitions(_automat.size());
+  for (std::size_t i = 0; i < _automat.size(); i++) {
+    cuBool_Index nvals = 0;
+    cuBool_Matrix_Nvals(_automat[i], &nvals);
+    std::vector<cuBool_Index> rows(nvals), cols(nvals);
+    cuBool_Matrix_ExtractPairs(_automat[i], rows.data(), cols.data(), &nvals);
+    for (cuBool_Index j = 0; j < nvals; j++) {
+      transitions[i].emplace_back(rows[j], cols[j]);
+    }
+  }
+
+  bool substituted = false;
+  const cuBool_Index original_states_number = states_number;
+  for (cuBool_Index state = 0; state < original_states_number; state++) {
+    std::vector<uint32_t> loop_labels;
+    std::vector<bool> loop_inversed;
+    for (std::size_t i = 0; i < transitions.size(); i++) {
+      if (std::ranges::find(transitions[i], Transition {state, state}) != transitions[i].end()) {
+        loop_labels.push_back(_labels[i]);
+        loop_inversed.push_back(_inverse_lables[i]);
+      }
+    }
+    if (loop_labels.empty() || std::ranges::count(loop_inversed, loop_inversed.front()) !=
+                                 std::ssize(loop_inversed)) {
+      continue;
+    }
+
+    std::ranges::sort(loop_labels);
+    auto closure = _closure_index->find(loop_labels);
+    if (!closure.has_value()) {
+      continue;
+    }
+    bool inversed = loop_inversed.front();
+
+    cuBool_Index entry = states_number++;
+    for (auto &label_transitions : transitions) {
+      std::vector<Transition> updated;
+      for (auto [from, to] : label_transitions) {
+        if (from == state && to == state) {
+          continue;
+        }
+        updated.emplace_back(from, to == state ? entry : to);
+        if (from == state) {
+          updated.emplace_back(entry, to);
+        }
+      }
+      label_transitions = std::move(updated);
+    }
+
+    std::size_t closure_label = 0;
+    while (closure_label < _labels.size() && (_labels[closure_label] != closure.value() ||
+                                              _inverse_lables[closure_label] != inversed)) {
+      closure_label++;
+    }
+    if (closure_label == _labels.size()) {
+      _labels.push_back(closure.value());
+      _inverse_lables.push_back(inversed);
+      _automat.push_back(nullptr);
+      _graph.push_back(nullptr);
+      transitions.emplace_back();
+      if (!preloaded) {
+        if (not matrices[closure.value()].copy_to_gpu(&_graph.back())) {
+          return false;
+        }
+      } else {
+        _graph.back() = matrices[closure.value()]._matrix;
+      }
+    }
+    transitions[closure_label].emplace_back(entry, state);
+
+    std::ranges::replace(start_states, state, entry);
+    if (std::ranges::find(final_states, state) != final_states.end()) {
+      final_states.push_back(entry);
+    }
+    substituted = true;
+  }
+
+  if (!substituted) {
+    return true;
+  }
+
+  for (std::size_t i = 0; i < _automat.size(); i++) {
+    if (_automat[i] != nullptr) {
+      cuBool_Matrix_Free(_automat[i]);
+    }
+
+    std::vector<cuBool_Index> rows, cols;
+    for (auto [from, to] : transitions[i]) {
+      rows.push_back(from);
+      cols.push_back(to);
+    }
+    if (cuBool_Matrix_New(&_automat[i], states_number, states_number) != CUBOOL_STATUS_SUCCESS ||
+        cuBool_Matrix_Build(_automat[i], rows.data(), cols.data(), rows.size(), CUBOOL_HINT_NO) !=
+          CUBOOL_STATUS_SUCCESS) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+QueryPlan Query::plan_direction(const Wikidata &matrices,
+                                const std::vector<cuBool_Index> &start_states,
+                                const std::vector<cuBool_Index> &final_states) const {
+  std::vector<CsrAdjacency> automat_adjacency;
+  std::vector<const CsrAdjacency *> automat_pointers;
+  std::vector<const LabelStatistics *> statistics;
+  automat_adjacency.reserve(_automat.size());
+  for (std::size_t i = 0; i < _automat.size(); i++) {
+    automat_adjacency.push_back(CsrAdjacency::from_matrix(_automat[i]));
+    automat_pointers.push_back(&automat_adjacency.back());
+    statistics.push_back(&matrices[_labels[i]]._statistics);
+  }
+
+  return plan_query(automat_pointers, statistics, _inverse_lables, start_states, final_states);
+}
+
+void Query::clear() {
+  if (_matrices_was_loaded) {
+    for (auto &matrix : _graph) {
+      if (matrix != nullptr) {
+        cuBool_Matrix_Free(matrix);
+        matrix = nullptr;
+      }
+    }
+  }
+
+  for (auto &matrix : _automat) {
+    if (matrix != nullptr) {
+      cuBool_Matrix_Free(matrix);
+      matrix = nullptr;
+    }
+  }
+
+  // std::println("clear 3 transposed");
+  if (_transposed) {
+    for (auto &matrix : _graph_transposed) {
+      if (matrix != nullptr) {
+        cuBool_Matrix_Free(matrix);
+        matrix = nullptr;
+      }
+    }
+    for (auto &matrix : _automat_transposed) {
+      if (matrix != nullptr) {
+        cuBool_Matrix_Free(matrix);
+        matrix = nullptr;
+      }
+    }
+  }
+}
+
+// number of graph vertices reached in final states,
+// and whether target vertex is among them if it is set
+static uint32_t count_answers(cuBool_Matrix reacheble,
+                              const std::vector<cuBool_Index> &final_states,
+                              std::optional<cuBool_Index> target_vertex,
+                              std::optional<bool> &target_reached) {
+  cuBool_Index automat_rows, graph_rows;
+  cuBool_Matrix_Nrows(reacheble, &automat_rows);
+  cuBool_Matrix_Ncols(reacheble, &graph_rows);
+
+  cuBool_Vector P, F;
+  cuBool_Vector_New(&P, graph_rows);
+  cuBool_Vector_New(&F, automat_rows);
+
+  cuBool_Vector_Build(F, final_states.data(), final_states.size(), CUBOOL_HINT_NO);
+  cuBool_VxM(P, F, reacheble, CUBOOL_HINT_NO);
+  uint32_t answer = 0;
+  cuBool_Vector_Nvals(P, &answer);
+
+  target_reached.reset();
+  if (target_vertex.has_value()) {
+    cuBool_Index nvals = answer;
+    std::vector<cuBool_Index> vertices(nvals);
+    cuBool_Vector_ExtractValues(P, vertices.data(), &nvals);
+    target_reached = std::ranges::find(vertices, target_vertex.value()) != vertices.end();
+  }
+
+  cuBool_Vector_Free(P);
+  cuBool_Vector_Free(F);
+
+  return answer;
+}
+
+std::pair<uint32_t, double> Query::execute() {
+  std::string filename = std::format("{}/{}.txt", QUERIES_LOGS, _query_number);
+  std::ofstream log_file(filename);
+
+  if (_use_planner) {
+    std::println(log_file, "plan: forward cost = {}, backward cost = {}, direction = {}",
+                 _plan._forward_cost, _plan._backward_cost,
+                 _labels_inversed ? "backward" : "forward");
+  }
+
+  cuBool_Matrix recheable = nullptr;
+
+  static Timer make_query_timer {};
+
+  _status = QueryStatus::Ok;
+  make_query_timer.mark();
+  if (_engine == RpqEngine::Async && !_graph_adjacency.empty()) {
+    cuBool_Index graph_nodes_number = _graph_adjacency.front()->_nrows;
+    cuBool_Index automat_nodes_number = 0;
+    cuBool_Matrix_Nrows(_automat.front(), &automat_nodes_number);
+
+    std::vector<CsrAdjacency> automat_adjacency;
+    std::vector<const CsrAdjacency *> automat_pointers;
+    automat_adjacency.reserve(_automat.size());
+    for (auto label_matrix : _automat) {
+      automat_adjacency.push_back(CsrAdjacency::from_matrix(label_matrix, _labels_inversed));
+      automat_pointers.push_back(&automat_adjacency.back());
+    }
+
+    recheable = async_regular_path_query_with_adjacency(_graph_adjacency, _sourece_vertices,
+                                                        automat_pointers, _start_states,
+                                                        graph_nodes_number, automat_nodes_number,
+                                                        _budget, _status);
+  } else if (_engine == RpqEngine::Async) {
+    recheable = async_regular_path_query(_graph, _sourece_vertices,
+                                         _automat, _start_states,
+                                         _inverse_lables, _labels_inversed,
+                                         _budget, _status);
+  } else if (_transposed) {
+    recheable = par_regular_path_query_with_transposed(_graph, _sourece_vertices,
+                                                       _automat, _start_states,
+                                                       _graph_transposed,
+                                                       _automat_transposed,
+                                                       _inverse_lables, _labels_inversed,
+                                                       _graph_adjacency,
+                                                       _budget, _status, _threads_number);
+  } else {
+    recheable = par_regular_path_query(_graph, _sourece_vertices,
+                                       _automat, _start_states,
+                                       _inverse_lables, _labels_inversed,
+                                       _budget, _status, _threads_number);
+  }
+
+  // scratch of stopped query is already freed by engine
+  _target_reached.reset();
+  if (recheable == nullptr) {
+    return {0, make_query_timer.measure()};
+  }
+
+  uint32_t answer = count_answers(recheable, _final_states, _target_vertex, _target_reached);
+
+  auto time = make_query_timer.measure();
+
+  cuBool_Matrix_Free(recheable);
+
+  return {answer, time};
+}
+
+std::vector<std::pair<uint32_t, double>> execute_batch(const std::vector<Query *> &queries) {
+  cuBool_Status status;
+  assert(!queries.empty());
+
+  static Timer batch_timer {};
+  batch_timer.mark();
+
+  const auto &first = *queries.front();
+
+  // labels of all queries, same graph label used in the same way is shared
+  std::map<std::pair<uint32_t, bool>, std::size_t> label_indices;
+  std::vector<cuBool_Matrix> graph, graph_transposed;
+  std::vector<const CsrAdjacency *> graph_adjacency;
+  std::vector<bool> inversed_labels;
+  std::vector<std::vector<cuBool_Index>> automat_rows, automat_cols;
+  bool transposed = true;
+
+  // every automat gets its own range of states in disjoint union
+  std::vector<cuBool_Index> offsets;
+  cuBool_Index states_number = 0;
+  std::vector<cuBool_Index> start_states;
+
+  for (const auto *query : queries) {
+    assert(query->_sourece_vertices == first._sourece_vertices);
+    assert(query->_labels_inversed == first._labels_inversed);
+
+    cuBool_Index query_states = 0;
+    cuBool_Matrix_Nrows(query->_automat.front(), &query_states);
+    offsets.push_back(states_number);
+    for (auto state : query->_start_states) {
+      start_states.push_back(state + states_number);
+    }
+
+    transposed &= query->_transposed;
+    for (std::size_t i = 0; i < query->_labels.size(); i++) {
+      auto [it, inserted] =
+        label_indices.try_emplace({query->_labels[i], query->_inverse_lables[i]}, graph.size());
+      if (inserted) {
+        graph.push_back(query->_graph[i]);
+        graph_transposed.push_back(query->_transposed ? query->_graph_transposed[i] : nullptr);
+        graph_adjacency.push_back(i < query->_graph_adjacency.size() ? query->_graph_adjacency[i]
+                                                                     : nullptr);
+        inversed_labels.push_back(query->_inverse_lables[i]);
+        automat_rows.emplace_back();
+        automat_cols.emplace_back();
+      }
+
+      auto &rows = automat_rows[it->second];
+      auto &cols = automat_cols[it->second];
+      cuBool_Index nvals = 0;
+      cuBool_Matrix_Nvals(query->_automat[i], &nvals);
+      auto begin = rows.size();
+      rows.resize(begin + nvals);
+      cols.resize(begin + nvals);
+      cuBool_Matrix_ExtractPairs(query->_automat[i], rows.data() + begin, cols.data() + begin,
+                               &nvals);
+      for (auto j = begin; j < rows.size(); j++) {
+        rows[j] += states_number;
+        cols[j] += states_number;
+      }
+    }
+
+    states_number += query_states;
+  }
+
+  std::vector<cuBool_Matrix> automat(graph.size()), automat_transposed(graph.size());
+  for (std::size_t i = 0; i < graph.size(); i++) {
+    status = cuBool_Matrix_New(&automat[i], states_number, states_number);
+    assert(status == CUBOOL_STATUS_SUCCESS);
+    status = cuBool_Matrix_Build(automat[i], automat_rows[i].data(), automat_cols[i].data(),
+                                 automat_rows[i].size(), CUBOOL_HINT_NO);
+    assert(status == CUBOOL_STATUS_SUCCESS);
+
+    status = cuBool_Matrix_New(&automat_transposed[i], states_number, states_number);
+    assert(status == CUBOOL_STATUS_SUCCESS);
+    status = cuBool_Matrix_Transpose(automat_transposed[i], automat[i], CUBOOL_HINT_NO);
+    assert(status == CUBOOL_STATUS_SUCCESS);
+  }
+
+  // batch runs under budget of its first query, status is shared by all queries
+  QueryStatus query_status = QueryStatus::Ok;
+  cuBool_Matrix recheable = nullptr;
+  if (transposed) {
+    recheable = par_regular_path_query_with_transposed(graph, first._sourece_vertices,
+                                                       automat, start_states,
+                                                       graph_transposed, automat_transposed,
+                                                       inversed_labels, first._labels_inversed,
+                                                       graph_adjacency, first._budget, query_status,
+                                                       first._threads_number);
+  } else {
+    recheable = par_regular_path_query(graph, first._sourece_vertices,
+                                       automat, start_states,
+                                       inversed_labels, first._labels_inversed,
+                                       first._budget, query_status, first._threads_number);
+  }
+  for (auto *query : queries) {
+    query->_status = query_status;
+    query->_target_reached.reset();
+  }
+
+  // split answers back by final states of every automat
+  std::vector<uint32_t> answers(queries.size(), 0);
+  for (std::size_t k = 0; recheable != nullptr && k < queries.size(); k++) {
+    std::vector<cuBool_Index> final_states;
+    for (auto state : queries[k]->_final_states) {
+      final_states.push_back(state + offsets[k]);
+    }
+    answers[k] = count_answers(recheable, final_states, queries[k]->_target_vertex,
+                               queries[k]->_target_reached);
+  }
+
+  // batch time is shared equally
+  auto time = batch_timer.measure() / queries.size();
+
+  if (recheable != nullptr) {
+    cuBool_Matrix_Free(recheable);
+  }
+  for (std::size_t i = 0; i < graph.size(); i++) {
+    cuBool_Matrix_Free(automat[i]);
+    cuBool_Matrix_Free(automat_transposed[i]);
+  }
+
+  std::vector<std::pair<uint32_t, double>> result;
+  for (auto answer : answers) {
+    result.emplace_back(answer, time);
+  }
+  return result;
+}
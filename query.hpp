@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <cubool/cubool.h>
+
+#include "csr_adjacency.hpp"
+#include "planner.hpp"
+#include "query_budget.hpp"
+#include "timer.hpp"
+
+#define QUERIES_LOGS "queries_logs"
+
+enum class RpqEngine {
+  // level-synchronous matrix algorithm
+  Matrix,
+  // barrier-free product graph traversal
+  Async,
+};
+
+struct MatrixData {
+  bool _loaded = false;
+  int64_t _nrows = 0, _ncols = 0;
+  std::vector<cuBool_Index> _rows, _cols;
+  cuBool_Index _nvals = 0;
+
+  // set when triplets were moved to memory shared between processes, vectors are empty then
+  const cuBool_Index *_shared_rows = nullptr, *_shared_cols = nullptr;
+
+  const cuBool_Index *rows() const {
+    return _shared_rows != nullptr ? _shared_rows : _rows.data();
+  }
+
+  const cuBool_Index *cols() const {
+    return _shared_cols != nullptr ? _shared_cols : _cols.data();
+  }
+
+  cuBool_Matrix _matrix = nullptr, _transposed = nullptr;
+
+  // host copies for async engine and for matrix engine products on CPU builds
+  CsrAdjacency _adjacency, _adjacency_transposed;
+
+  LabelStatistics _statistics;
+
+  double sizeMb() const {
+    return (sizeof(cuBool_Index) * _nvals * 2) / 1'000'000.0;
+  }
+
+  // approximate memory of built matrix in CSR format and of host adjacency copies
+  double residentMb() const {
+    uint64_t bytes = 0;
+    if (_matrix != nullptr) {
+      bytes += (uint64_t(_nrows) + 1 + _nvals) * sizeof(cuBool_Index);
+    }
+    bytes += _adjacency.bytes() + _adjacency_transposed.bytes();
+    return bytes / 1'000'000.0;
+  }
+
+  bool load_to_cpu(std::string_view filename);
+  bool copy_to_gpu(cuBool_Matrix *matrix) const;
+
+  bool load_to_gpu() {
+    return copy_to_gpu(&_matrix);
+  }
+
+  // everything queries use: matrix and, on CPU builds, its adjacency in both orientations
+  bool prepare() {
+    if (!load_to_gpu()) {
+      return false;
+    }
+#ifdef RPQ_RUN_ON_CPU
+    // label products are computed over adjacency, so it is built once here
+    build_adjacency();
+#endif
+    return true;
+  }
+
+  void release() {
+    if (_matrix != nullptr) {
+      cuBool_Matrix_Free(_matrix);
+      _matrix = nullptr;
+    }
+    _adjacency = {};
+    _adjacency_transposed = {};
+  }
+
+  void build_adjacency() {
+    if (!_adjacency.empty()) {
+      return;
+    }
+    _adjacency = CsrAdjacency::from_pairs(_nrows, _ncols, rows(), cols(), _nvals);
+    _adjacency_transposed =
+      CsrAdjacency::from_pairs(_nrows, _ncols, rows(), cols(), _nvals, true);
+  }
+
+  ~MatrixData() {
+    if (_matrix != nullptr) {
+      cuBool_Matrix_Free(_matrix);
+    }
+  }
+};
+using Wikidata = std::vector<MatrixData>;
+
+struct ClosureIndex;
+
+// graph labels which Query::load reads for query, empty if there is no such query
+std::vector<uint32_t> read_query_labels(uint32_t query_number);
+
+// label statistics are only needed by planner;
+// if closure_index is set, closures configured in <dataset>/closures.txt are
+// loaded from <dataset>/Closures or built and saved there
+Wikidata load_matrices(bool load_at_gpu = false, bool pretransposed = false,
+                       bool build_adjacency = false, bool collect_statistics = false,
+                       ClosureIndex *closure_index = nullptr);
+
+struct Query {
+  std::vector<cuBool_Matrix> _graph;
+  std::vector<cuBool_Matrix> _automat;
+
+  std::vector<cuBool_Matrix> _graph_transposed;
+  std::vector<cuBool_Matrix> _automat_transposed;
+  bool _transposed = false;
+
+  std::vector<cuBool_Index> _sourece_vertices;
+  std::vector<cuBool_Index> _start_states;
+
+  std::vector<cuBool_Index> _final_states;
+
+  std::vector<uint32_t> _labels;
+  std::vector<bool> _inverse_lables;
+  bool _labels_inversed = false;
+
+  // choose evaluation direction by label statistics, only applied when both
+  // source and dest are bound, otherwise direction is fixed by query itself
+  bool _use_planner = false;
+  QueryPlan _plan;
+  // set when both source and dest are bound: vertex at the end opposite to traversal start,
+  // answer is still number of reached vertices, _target_reached is set by execute
+  std::optional<cuBool_Index> _target_vertex;
+  std::optional<bool> _target_reached;
+
+  // substitute indexed closures for star subexpressions of automat
+  const ClosureIndex *_closure_index = nullptr;
+
+  bool _matrices_was_loaded = true;
+
+  RpqEngine _engine = RpqEngine::Matrix;
+  // oriented graph adjacency for async engine and for matrix engine on CPU builds,
+  // owned by Wikidata
+  std::vector<const CsrAdjacency *> _graph_adjacency;
+  // workers of matrix engine, 0 means all hardware threads
+  std::size_t _threads_number = 0;
+
+  // limits of execution and status of last execute, answer is 0 if it is not Ok
+  QueryBudget _budget;
+  QueryStatus _status = QueryStatus::Ok;
+
+  uint32_t _query_number = 0;
+  Timer _query_timer;
+
+  std::pair<bool, double> load(uint32_t query_number, const Wikidata &matrices,
+                               bool preloaded = false, bool transpose = true, bool pretransposed = false);
+  std::pair<uint32_t, double> execute();
+  void clear();
+
+  bool substitute_closures(const Wikidata &matrices, std::vector<cuBool_Index> &start_states,
+                           std::vector<cuBool_Index> &final_states, bool preloaded);
+
+  QueryPlan plan_direction(const Wikidata &matrices, const std::vector<cuBool_Index> &start_states,
+                           const std::vector<cuBool_Index> &final_states) const;
+
+  // load + execute + clear
+  std::pair<uint32_t, double> make(uint32_t query_number, const Wikidata &matrices,
+                                   bool preloaded = false, bool transpose = true) {
+    if (!load(query_number, matrices, preloaded, transpose).first) {
+      clear();
+      return {0, 0};
+    }
+    auto answer = execute();
+    clear();
+    return answer;
+  }
+
+
+  ~Query() {
+    clear();
+  }
+};
+
+// Evaluate queries with the same source vertices and direction in one traversal
+// over disjoint union of their automata, so label products are shared.
+// Execute time of the batch is split equally between queries.
+// Batch runs under budget of the first query, its status is set to every query.
+std::vector<std::pair<uint32_t, double>> execute_batch(const std::vector<Query *> &queries);
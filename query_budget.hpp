@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string_view>
+
+enum class QueryStatus {
+  Ok,
+  Cancelled,
+  IterationsExceeded,
+  FrontierExceeded,
+  MemoryExceeded,
+  TimeExceeded,
+};
+
+inline std::string_view to_string(QueryStatus status) {
+  switch (status) {
+    case QueryStatus::Ok:
+      return "ok";
+    case QueryStatus::Cancelled:
+      return "cancelled";
+    case QueryStatus::IterationsExceeded:
+      return "iterations budget exceeded";
+    case QueryStatus::FrontierExceeded:
+      return "frontier budget exceeded";
+    case QueryStatus::MemoryExceeded:
+      return "memory budget exceeded";
+    case QueryStatus::TimeExceeded:
+      return "time budget exceeded";
+  }
+  return "unknown";
+}
+
+// Every query gets its own id when it starts and cancel carries id of the query it
+// is meant for, so cancel which comes before query starts is not lost and cancel
+// which comes after query ends does not stop the next one.
+// Cancel may come from any thread (or signal handler), query stops at next check.
+class CancellationToken {
+private:
+  // ids start from 1, 0 means no query
+  std::atomic<uint32_t> _current = 0;
+  std::atomic<uint32_t> _cancelled = 0;
+
+public:
+  void start(uint32_t id) {
+    _current.store(id, std::memory_order_relaxed);
+  }
+
+  void cancel(uint32_t id) {
+    _cancelled.store(id, std::memory_order_relaxed);
+  }
+
+  bool cancelled() const {
+    uint32_t current = _current.load(std::memory_order_relaxed);
+    return current != 0 && _cancelled.load(std::memory_order_relaxed) == current;
+  }
+};
+
+// per query limits, zero means unlimited, checked between iterations
+// with number of iterations already done
+struct QueryBudget {
+  uint64_t _max_iterations = 0;
+  uint64_t _max_frontier_nnz = 0;
+  uint64_t _max_scratch_bytes = 0;
+  double _max_time = 0;
+  const CancellationToken *_token = nullptr;
+
+  QueryStatus check(uint64_t iterations, uint64_t frontier_nnz, uint64_t scratch_bytes,
+                    double elapsed) const {
+    if (_token != nullptr && _token->cancelled()) {
+      return QueryStatus::Cancelled;
+    }
+    if (_max_iterations != 0 && iterations >= _max_iterations) {
+      return QueryStatus::IterationsExceeded;
+    }
+    if (_max_frontier_nnz != 0 && frontier_nnz > _max_frontier_nnz) {
+      return QueryStatus::FrontierExceeded;
+    }
+    if (_max_scratch_bytes != 0 && scratch_bytes > _max_scratch_bytes) {
+      return QueryStatus::MemoryExceeded;
+    }
+    if (_max_time != 0 && elapsed > _max_time) {
+      return QueryStatus::TimeExceeded;
+    }
+    return QueryStatus::Ok;
+  }
+};
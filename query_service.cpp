@@ -0,0 +1,692 @@
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <format>
+#include <print>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "query.hpp"
+#include "query_budget.hpp"
+#include "query_service.hpp"
+
+namespace {
+
+volatile sig_atomic_t stop_requested = 0;
+
+void on_stop_signal(int) {
+  stop_requested = 1;
+}
+
+// in worker: coordinator queues SIGUSR1 with sequence of query in flight to cancel it
+CancellationToken cancellation_token;
+
+void on_cancel_signal(int, siginfo_t *info, void *) {
+  if (info->si_code == SI_QUEUE) {
+    cancellation_token.cancel(info->si_value.sival_int);
+  }
+}
+
+bool write_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    ssize_t written = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data.remove_prefix(written);
+  }
+  return true;
+}
+
+// read available data and call on_line for every complete line,
+// returns false if peer closed connection
+template <typename F>
+bool read_lines(int fd, std::string &buffer, F &&on_line) {
+  char chunk[4096];
+  ssize_t received = 0;
+  do {
+    received = read(fd, chunk, sizeof(chunk));
+  } while (received < 0 && errno == EINTR);
+  if (received <= 0) {
+    return false;
+  }
+  buffer.append(chunk, received);
+
+  std::size_t begin = 0, end = 0;
+  while ((end = buffer.find('\n', begin)) != std::string::npos) {
+    on_line(std::string_view(buffer).substr(begin, end - begin));
+    begin = end + 1;
+  }
+  buffer.erase(0, begin);
+  return true;
+}
+
+bool parse_query_number(std::string_view text, uint32_t &value) {
+  auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+  return ec == std::errc() && ptr == text.data() + text.size();
+}
+
+sockaddr_un make_address(std::string_view socket_path) {
+  sockaddr_un address {};
+  address.sun_family = AF_UNIX;
+  socket_path.copy(address.sun_path, sizeof(address.sun_path) - 1);
+  return address;
+}
+
+// label triplets moved to MAP_SHARED memory, so every forked worker
+// builds its matrices from one physical copy
+class SharedLabelStore {
+private:
+  void *_memory = MAP_FAILED;
+  std::size_t _size = 0;
+
+public:
+  bool share(Wikidata &matrices) {
+    for (const auto &data : matrices) {
+      if (data._loaded) {
+        _size += sizeof(cuBool_Index) * data._nvals * 2;
+      }
+    }
+    if (_size == 0) {
+      return true;
+    }
+
+    _memory = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (_memory == MAP_FAILED) {
+      return false;
+    }
+
+    auto *cursor = static_cast<cuBool_Index *>(_memory);
+    for (auto &data : matrices) {
+      if (!data._loaded) {
+        continue;
+      }
+      std::copy_n(data.rows(), data._nvals, cursor);
+      data._shared_rows = cursor;
+      cursor += data._nvals;
+      std::copy_n(data.cols(), data._nvals, cursor);
+      data._shared_cols = cursor;
+      cursor += data._nvals;
+
+      data._rows = {};
+      data._cols = {};
+    }
+
+    // workers only read labels
+    mprotect(_memory, _size, PROT_READ);
+    return true;
+  }
+
+  double sizeMb() const {
+    return _size / 1'000'000.0;
+  }
+
+  ~SharedLabelStore() {
+    if (_memory != MAP_FAILED) {
+      munmap(_memory, _size);
+    }
+  }
+};
+
+// Matrices of worker are private, only triplets are shared, so labels are built
+// from them when a query needs them first time. If cache limit is set,
+// least recently used labels are released when resident size exceeds it.
+class LabelCache {
+private:
+  Wikidata &_matrices;
+  double _limit_mb = 0;
+  double _resident_mb = 0;
+  uint64_t _clock = 0;
+  std::vector<uint64_t> _last_used;
+
+public:
+  LabelCache(Wikidata &matrices, double limit_mb)
+    : _matrices(matrices), _limit_mb(limit_mb), _last_used(matrices.size(), 0) {}
+
+  bool acquire(const std::vector<uint32_t> &labels) {
+    _clock++;
+    for (auto label : labels) {
+      auto &data = _matrices[label];
+      _last_used[label] = _clock;
+      if (!data._loaded) {
+        // label file is missing, query can not be loaded
+        return false;
+      }
+      if (data._matrix != nullptr) {
+        continue;
+      }
+      if (!data.prepare()) {
+        return false;
+      }
+      _resident_mb += data.residentMb();
+    }
+
+    // labels of current query are never released
+    while (_limit_mb != 0 && _resident_mb > _limit_mb) {
+      std::size_t oldest = _matrices.size();
+      for (std::size_t label = 0; label < _matrices.size(); label++) {
+        if (_matrices[label]._matrix != nullptr && _last_used[label] < _clock &&
+            (oldest == _matrices.size() || _last_used[label] < _last_used[oldest])) {
+          oldest = label;
+        }
+      }
+      if (oldest == _matrices.size()) {
+        break;
+      }
+      _resident_mb -= _matrices[oldest].residentMb();
+      _matrices[oldest].release();
+    }
+    return true;
+  }
+};
+
+[[noreturn]] void worker_main(int fd, Wikidata &matrices, QueryBudget budget,
+                              double label_cache_mb) {
+  budget._token = &cancellation_token;
+
+  cuBool_Initialize(CUBOOL_HINT_NO);
+  LabelCache cache(matrices, label_cache_mb);
+
+  std::string buffer;
+  bool running = true;
+  while (running) {
+    running = read_lines(fd, buffer, [&](std::string_view line) {
+      // <sequence> <query_number>, cancel signal carries sequence of its query
+      auto space = line.find(' ');
+      uint32_t sequence = 0, query_number = 0;
+      if (space == std::string_view::npos ||
+          !parse_query_number(line.substr(0, space), sequence) ||
+          !parse_query_number(line.substr(space + 1), query_number)) {
+        running = write_all(fd, "error bad request\n");
+        return;
+      }
+      cancellation_token.start(sequence);
+
+      Query query;
+      query._budget = budget;
+      if (!cache.acquire(read_query_labels(query_number)) ||
+          !query.load(query_number, matrices, true).first) {
+        running = write_all(fd, "error load failed\n");
+        return;
+      }
+      auto [answer, execute_time] = query.execute();
+      query.clear();
+      if (query._status != QueryStatus::Ok) {
+        running = write_all(fd, std::format("error {}\n", to_string(query._status)));
+        return;
+      }
+      running = write_all(fd, std::format("{} {}\n", answer, execute_time));
+    }) && running;
+  }
+
+  cuBool_Finalize();
+  _exit(0);
+}
+
+struct PendingQuery {
+  uint64_t _client_id = 0;
+  uint32_t _query_number = 0;
+  Timer _latency_timer {};
+  // marked when query is sent to worker
+  Timer _execute_timer {};
+  // set when query is sent to worker, tells cancel signal which query it is for
+  uint32_t _sequence = 0;
+  bool _cancel_requested = false;
+};
+
+struct Shard {
+  pid_t _pid = -1;
+  int _fd = -1;
+  std::string _input;
+
+  // only front query is sent to worker, so queued ones can be cancelled
+  // without touching worker
+  std::deque<PendingQuery> _queue;
+  // worker is killed because front query ignored its deadline
+  bool _killed = false;
+  // sequence of last query sent to worker, 0 is never used
+  uint32_t _sequence = 0;
+
+  uint64_t _done = 0, _failed = 0, _cancelled = 0;
+  double _total_latency = 0, _max_latency = 0;
+};
+
+struct Client {
+  int _fd = -1;
+  std::string _input;
+};
+
+class Coordinator {
+private:
+  Wikidata &_matrices;
+  QueryBudget _budget;
+  double _label_cache_mb = 0;
+  int _listen_fd = -1;
+  std::vector<Shard> _shards;
+  std::unordered_map<uint64_t, Client> _clients;
+  uint64_t _next_client_id = 0;
+  bool _running = true;
+
+  void reply(uint64_t client_id, std::string_view message) {
+    auto it = _clients.find(client_id);
+    if (it != _clients.end()) {
+      write_all(it->second._fd, message);
+    }
+  }
+
+  bool spawn(std::size_t shard_index) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+      return false;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+      close(fds[0]);
+      close(fds[1]);
+      return false;
+    }
+
+    if (pid == 0) {
+      // worker must not hold coordinator descriptors
+      close(fds[0]);
+      close(_listen_fd);
+      for (const auto &shard : _shards) {
+        if (shard._fd >= 0) {
+          close(shard._fd);
+        }
+      }
+      for (const auto &[_, client] : _clients) {
+        close(client._fd);
+      }
+      signal(SIGINT, SIG_DFL);
+      signal(SIGTERM, SIG_DFL);
+      worker_main(fds[1], _matrices, _budget, _label_cache_mb);
+    }
+
+    close(fds[1]);
+    auto &shard = _shards[shard_index];
+    shard._pid = pid;
+    shard._fd = fds[0];
+    shard._input.clear();
+    shard._killed = false;
+    return true;
+  }
+
+  void send_front(Shard &shard) {
+    if (shard._queue.empty()) {
+      return;
+    }
+    auto &pending = shard._queue.front();
+    pending._execute_timer.mark();
+    if (++shard._sequence == 0) {
+      shard._sequence = 1;
+    }
+    pending._sequence = shard._sequence;
+    write_all(shard._fd, std::format("{} {}\n", pending._sequence, pending._query_number));
+  }
+
+  void on_shard_line(std::size_t shard_index, std::string_view line) {
+    auto &shard = _shards[shard_index];
+    if (shard._queue.empty()) {
+      return;
+    }
+    auto pending = std::move(shard._queue.front());
+    shard._queue.pop_front();
+
+    double latency = pending._latency_timer.measure();
+    shard._total_latency += latency;
+    shard._max_latency = std::max(shard._max_latency, latency);
+
+    if (line.starts_with("error")) {
+      shard._failed++;
+      if (pending._cancel_requested) {
+        shard._cancelled++;
+      }
+      reply(pending._client_id, std::format("{} {}\n", pending._query_number, line));
+    } else {
+      shard._done++;
+      reply(pending._client_id,
+            std::format("{} {} {} {}\n", pending._query_number, line, latency, shard_index));
+    }
+    send_front(shard);
+  }
+
+  // worker died on the query at the front of its queue: fail it, restart worker
+  // and resend the rest
+  void on_shard_died(std::size_t shard_index) {
+    auto &shard = _shards[shard_index];
+    close(shard._fd);
+    shard._fd = -1;
+
+    int wait_status = 0;
+    waitpid(shard._pid, &wait_status, 0);
+    std::println("shard {}: worker {} exited with status {}", shard_index, shard._pid,
+                 wait_status);
+    shard._pid = -1;
+
+    if (!shard._queue.empty()) {
+      auto &pending = shard._queue.front();
+      shard._failed++;
+      reply(pending._client_id,
+            std::format("{} error shard {} {}\n", pending._query_number, shard_index,
+                        shard._killed ? "killed after deadline" : "crashed"));
+      shard._queue.pop_front();
+    }
+
+    if (!_running || !spawn(shard_index)) {
+      for (auto &pending : shard._queue) {
+        shard._failed++;
+        reply(pending._client_id,
+              std::format("{} error shard {} unavailable\n", pending._query_number, shard_index));
+      }
+      shard._queue.clear();
+      return;
+    }
+
+    send_front(shard);
+  }
+
+  void submit(uint64_t client_id, uint32_t query_number) {
+    std::size_t best = _shards.size();
+    for (std::size_t i = 0; i < _shards.size(); i++) {
+      if (_shards[i]._fd < 0) {
+        continue;
+      }
+      if (best == _shards.size() || _shards[i]._queue.size() < _shards[best]._queue.size()) {
+        best = i;
+      }
+    }
+    if (best == _shards.size()) {
+      reply(client_id, std::format("{} error no shards\n", query_number));
+      return;
+    }
+
+    auto &shard = _shards[best];
+    shard._queue.push_back({client_id, query_number});
+    if (shard._queue.size() == 1) {
+      send_front(shard);
+    }
+  }
+
+  // queued queries are dropped at once, query in flight is signalled
+  // and answers with error when worker notices it
+  bool cancel(uint32_t query_number) {
+    bool found = false;
+    for (std::size_t i = 0; i < _shards.size(); i++) {
+      auto &shard = _shards[i];
+      for (auto it = shard._queue.begin(); it != shard._queue.end();) {
+        if (it->_query_number != query_number) {
+          ++it;
+          continue;
+        }
+        found = true;
+        if (it == shard._queue.begin()) {
+          if (!it->_cancel_requested) {
+            it->_cancel_requested = true;
+            sigval value {};
+            value.sival_int = it->_sequence;
+            sigqueue(shard._pid, SIGUSR1, value);
+          }
+          ++it;
+          continue;
+        }
+        shard._failed++;
+        shard._cancelled++;
+        reply(it->_client_id, std::format("{} error cancelled\n", query_number));
+        it = shard._queue.erase(it);
+      }
+    }
+    return found;
+  }
+
+  // cooperative budget is checked between iterations only, so worker
+  // which is far behind deadline is killed and restarted
+  void check_deadlines() {
+    if (_budget._max_time == 0) {
+      return;
+    }
+    for (auto &shard : _shards) {
+      if (shard._queue.empty() || shard._killed || shard._pid < 0) {
+        continue;
+      }
+      auto timer = shard._queue.front()._execute_timer;
+      if (timer.measure() > _budget._max_time * 2 + 1) {
+        shard._killed = true;
+        kill(shard._pid, SIGKILL);
+      }
+    }
+  }
+
+  std::string stats() const {
+    std::string result;
+    for (std::size_t i = 0; i < _shards.size(); i++) {
+      const auto &shard = _shards[i];
+      uint64_t finished = shard._done + shard._failed;
+      double average = finished == 0 ? 0 : shard._total_latency / finished;
+      result += std::format(
+        "{}shard {}: pid = {}, queue = {}, done = {}, failed = {}, cancelled = {}, "
+        "avg latency = {}, max latency = {}",
+        i == 0 ? "" : "; ", i, shard._pid, shard._queue.size(), shard._done, shard._failed,
+        shard._cancelled, average, shard._max_latency);
+    }
+    return result + "\n";
+  }
+
+  void on_client_line(uint64_t client_id, std::string_view line) {
+    if (line.starts_with("query ")) {
+      uint32_t query_number = 0;
+      if (!parse_query_number(line.substr(6), query_number)) {
+        reply(client_id, "error bad query number\n");
+        return;
+      }
+      submit(client_id, query_number);
+    } else if (line.starts_with("cancel ")) {
+      uint32_t query_number = 0;
+      if (!parse_query_number(line.substr(7), query_number)) {
+        reply(client_id, "error bad query number\n");
+        return;
+      }
+      reply(client_id, cancel(query_number) ? "ok\n" : "error query not found\n");
+    } else if (line == "stats") {
+      reply(client_id, stats());
+    } else if (line == "shutdown") {
+      reply(client_id, "ok\n");
+      _running = false;
+    } else {
+      reply(client_id, "error unknown command\n");
+    }
+  }
+
+public:
+  Coordinator(Wikidata &matrices, int listen_fd, std::size_t workers_number,
+              const QueryBudget &budget, double label_cache_mb)
+    : _matrices(matrices), _budget(budget), _label_cache_mb(label_cache_mb),
+      _listen_fd(listen_fd), _shards(workers_number) {}
+
+  bool start() {
+    for (std::size_t i = 0; i < _shards.size(); i++) {
+      if (!spawn(i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void run() {
+    std::vector<pollfd> fds;
+    std::vector<uint64_t> client_ids;
+    // wake up to check deadlines if they are set
+    int poll_timeout = _budget._max_time == 0 ? -1 : 100;
+
+    while (_running && !stop_requested) {
+      fds.clear();
+      client_ids.clear();
+
+      fds.push_back({_listen_fd, POLLIN, 0});
+      for (const auto &shard : _shards) {
+        fds.push_back({shard._fd, POLLIN, 0});
+      }
+      for (const auto &[id, client] : _clients) {
+        fds.push_back({client._fd, POLLIN, 0});
+        client_ids.push_back(id);
+      }
+
+      if (poll(fds.data(), fds.size(), poll_timeout) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        std::println("poll failed: {}", std::strerror(errno));
+        break;
+      }
+      check_deadlines();
+
+      if (fds[0].revents & POLLIN) {
+        int client_fd = accept(_listen_fd, nullptr, nullptr);
+        if (client_fd >= 0) {
+          _clients[_next_client_id++] = Client {client_fd};
+        }
+      }
+
+      for (std::size_t i = 0; i < _shards.size(); i++) {
+        if (fds[i + 1].fd < 0 || fds[i + 1].revents == 0) {
+          continue;
+        }
+        bool alive = read_lines(_shards[i]._fd, _shards[i]._input,
+                                [&](std::string_view line) { on_shard_line(i, line); });
+        if (!alive) {
+          on_shard_died(i);
+        }
+      }
+
+      for (std::size_t i = 0; i < client_ids.size(); i++) {
+        if (fds[i + 1 + _shards.size()].revents == 0) {
+          continue;
+        }
+        uint64_t id = client_ids[i];
+        auto &client = _clients[id];
+        bool alive = read_lines(client._fd, client._input,
+                                [&](std::string_view line) { on_client_line(id, line); });
+        if (!alive) {
+          // answers for its pending queries will be dropped
+          close(client._fd);
+          _clients.erase(id);
+        }
+      }
+    }
+  }
+
+  ~Coordinator() {
+    _running = false;
+    for (auto &shard : _shards) {
+      if (shard._fd >= 0) {
+        // do not wait for pathological query to finish
+        close(shard._fd);
+        kill(shard._pid, SIGTERM);
+        waitpid(shard._pid, nullptr, 0);
+      }
+    }
+    for (const auto &[_, client] : _clients) {
+      close(client._fd);
+    }
+  }
+};
+
+}  // namespace
+
+bool run_query_service(std::string_view socket_path, std::size_t workers_number,
+                       double label_cache_mb, const QueryBudget &budget) {
+  // graphics API must not be initialized before fork, so only host copy is loaded here
+  auto matrices = load_matrices();
+
+  SharedLabelStore store;
+  if (!store.share(matrices)) {
+    std::println("failed to share label matrices: {}", std::strerror(errno));
+    return false;
+  }
+  std::println("label matrices shared, size: {}Mb", store.sizeMb());
+
+  std::filesystem::create_directory(QUERIES_LOGS);
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    return false;
+  }
+
+  auto address = make_address(socket_path);
+  unlink(address.sun_path);
+  if (bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+      listen(listen_fd, SOMAXCONN) != 0) {
+    std::println("failed to listen {}: {}", socket_path, std::strerror(errno));
+    close(listen_fd);
+    return false;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, on_stop_signal);
+  signal(SIGTERM, on_stop_signal);
+  // installed before fork, so worker can not be killed by early cancel
+  struct sigaction cancel_action {};
+  cancel_action.sa_sigaction = on_cancel_signal;
+  cancel_action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&cancel_action.sa_mask);
+  sigaction(SIGUSR1, &cancel_action, nullptr);
+
+  bool result = true;
+  {
+    Coordinator coordinator(matrices, listen_fd, workers_number, budget, label_cache_mb);
+    if (coordinator.start()) {
+      std::println("serving at {} with {} workers", socket_path, workers_number);
+      coordinator.run();
+    } else {
+      std::println("failed to start workers");
+      result = false;
+    }
+  }
+
+  close(listen_fd);
+  unlink(address.sun_path);
+  return result;
+}
+
+bool query_service_request(std::string_view socket_path, std::string_view request) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return false;
+  }
+
+  auto address = make_address(socket_path);
+  if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+    std::println("failed to connect {}: {}", socket_path, std::strerror(errno));
+    close(fd);
+    return false;
+  }
+
+  bool replied = false;
+  if (write_all(fd, std::format("{}\n", request))) {
+    std::string buffer;
+    while (!replied && read_lines(fd, buffer, [&](std::string_view line) {
+      std::println("{}", line);
+      replied = true;
+    })) {
+    }
+  }
+
+  close(fd);
+  return replied;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+#include "query_budget.hpp"
+
+// Long-running query service.
+//
+// Coordinator loads label triplets once into memory shared between processes,
+// forks workers_number worker processes and accepts line based requests
+// over Unix domain socket.
+// Only triplets are shared: every worker builds its own cuBool matrices (in VRAM on CUDA
+// builds) for labels of its queries when they are needed first time, so with many
+// distinct labels per shard memory still grows up to workers_number copies of label store.
+// label_cache_mb (0 means unlimited) bounds matrices of one worker, least recently used
+// labels are released and rebuilt from triplets when needed again.
+// Requests:
+//   query <query_number>  ->  <query_number> <answer> <execute_time> <latency> <shard>
+//                             or <query_number> error <reason>
+//   cancel <query_number> ->  ok or error query not found, cancelled query
+//                             answers <query_number> error cancelled
+//   stats                 ->  shard <i>: pid = .., queue = .., done = .., failed = ..,
+//                             cancelled = .., avg latency = .., max latency = ..; ...
+//   shutdown              ->  ok
+// Query goes to the shard with the shortest queue. Worker which dies on a query
+// is restarted, only that query fails and the rest of its queue is resent to the
+// new worker; if restart fails, queued queries fail too.
+// Every query runs under budget, over budget query answers <query_number> error <reason>.
+// If budget has time limit, worker which does not stop in twice that time is killed.
+bool run_query_service(std::string_view socket_path, std::size_t workers_number,
+                       double label_cache_mb = 0, const QueryBudget &budget = {});
+
+// send one request line to service and print reply
+bool query_service_request(std::string_view socket_path, std::string_view request);
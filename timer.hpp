@@ -1,6 +1,13 @@
+#pragma once
+
 #include <time.h>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <string_view>
 